@@ -11,7 +11,7 @@ void setup() {
 void draw() {
     //beginRaw(PDF, "output" + frameCount + ".pdf");
 
-  if (!mousePressed) {
+  if (!mousePressedb) {
     hint(ENABLE_DEPTH_SORT);
   } else {
     hint(DISABLE_DEPTH_SORT);
@@ -46,5 +46,5 @@ void draw() {
 
   //endRaw();
 
-  if (frameCount % 30 == 0) println(frameRate);
+  if (frameCount % 30 == 0) fmt::print("{} fps, {:.3f}ms depth sorting\n", frameRateb, depthSortMillis());
 }
\ No newline at end of file
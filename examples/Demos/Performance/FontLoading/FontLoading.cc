@@ -0,0 +1,38 @@
+/* FontLoading
+ *
+ * Times the first draw of text at a range of sizes, once when glyphs are
+ * rasterized as they're first drawn and once after createFont() has
+ * prerasterized the charset on worker threads. The profile.json written
+ * when the sketch exits shows the rasterizeGlyphs work on each thread.
+*/
+
+std::string sample = "The quick brown fox jumps over the lazy dog 0123456789";
+
+void setup() {
+  size(640, 360);
+
+  int start = millis();
+  for (int size = 10; size < 60; size += 5) {
+    textFont(createFont("SourceCodePro-Regular.ttf", size));
+    text(sample, 0, 0);
+  }
+  fmt::print("Rasterized on first draw: {}ms\n", millis() - start);
+
+  start = millis();
+  for (int size = 11; size < 61; size += 5) {
+    textFont(createFont("SourceCodePro-Regular.ttf", size, PFont::CHARSET));
+    text(sample, 0, 0);
+  }
+  fmt::print("Prerasterized: {}ms\n", millis() - start);
+}
+
+void draw() {
+  background(255);
+  fill(0);
+  float y = 10;
+  for (int size = 11; size < 61; size += 5) {
+    textFont(createFont("SourceCodePro-Regular.ttf", size));
+    y += size;
+    text(sample, 10, y);
+  }
+}
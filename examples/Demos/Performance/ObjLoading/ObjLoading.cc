@@ -0,0 +1,58 @@
+/* ObjLoading
+ *
+ * Writes out a large OBJ terrain mesh and times how long loadShape()
+ * takes to read it back in, then spins the result.
+*/
+#include <fstream>
+
+int gridSize = 400;
+PShape terrain;
+
+void writeTerrain(const std::string &path) {
+  std::ofstream out(path);
+  out << "# " << gridSize << "x" << gridSize << " terrain\n";
+  for (int j = 0; j < gridSize; j++) {
+    for (int i = 0; i < gridSize; i++) {
+      float x = map(i, 0, gridSize - 1, -1, 1);
+      float z = map(j, 0, gridSize - 1, -1, 1);
+      out << "v " << x << " " << noise(i * 0.02, j * 0.02) * 0.3 << " " << z << "\n";
+    }
+  }
+  for (int j = 0; j < gridSize; j++) {
+    for (int i = 0; i < gridSize; i++) {
+      out << "vt " << (float)i / (gridSize - 1) << " " << (float)j / (gridSize - 1) << "\n";
+    }
+  }
+  for (int j = 0; j < gridSize - 1; j++) {
+    for (int i = 0; i < gridSize - 1; i++) {
+      int a = j * gridSize + i + 1;
+      int b = a + 1;
+      int c = a + gridSize;
+      int d = c + 1;
+      out << "f " << a << "/" << a << " " << c << "/" << c << " " << d << "/" << d << " " << b << "/" << b << "\n";
+    }
+  }
+}
+
+void setup() {
+  size(640, 360, P3D);
+  noStroke();
+
+  writeTerrain("data/terrain.obj");
+
+  int runs = 5;
+  int start = millis();
+  for (int i = 0; i < runs; i++) {
+    terrain = loadShape("terrain.obj");
+  }
+  fmt::print("Loaded {}x{} OBJ terrain in {}ms on average\n", gridSize, gridSize, (millis() - start) / runs);
+  terrain.scale(200);
+}
+
+void draw() {
+  background(0);
+  lights();
+  translate(width/2, height/2);
+  rotateY(frameCount * 0.01);
+  shape(terrain);
+}
@@ -0,0 +1,39 @@
+/* Paragraphs
+ *
+ * Draws the same wrapped paragraph into six boxes with every combination
+ * of horizontal and vertical alignment each frame. After the first frame
+ * each box is a cached layout, so drawing it is just a lookup and the
+ * glyph quads.
+*/
+
+std::string paragraph =
+  "Boxed text is word wrapped to the width of the box and lines that "
+  "don't fit in its height are dropped. The layout is worked out from "
+  "glyph metrics once and kept, keyed by the font, size, string and box.";
+
+int aligns[] = { LEFT, CENTER, RIGHT };
+
+void setup() {
+  size(640, 360);
+  textFont(createFont("SourceCodePro-Regular.ttf", 13));
+}
+
+void draw() {
+  background(255);
+  int start = millis();
+  for (int row = 0; row < 2; row++) {
+    for (int col = 0; col < 3; col++) {
+      float x = 15 + col * 210;
+      float y = 15 + row * 175;
+      noFill();
+      stroke(200);
+      rect(x, y, 190, 160);
+      fill(0);
+      textAlign(aligns[col], row == 0 ? TOP : BOTTOM);
+      text(paragraph, x, y, 190, 160);
+    }
+  }
+  if (frameCount % 60 == 0) {
+    fmt::print("Six paragraphs in {}ms\n", millis() - start);
+  }
+}
@@ -0,0 +1,28 @@
+/* RectRendering
+ *
+ * Times 10,000 rect() and 10,000 ellipse() calls a frame, both filled and
+ * stroked, and every 60 frames prints the average. These are the two
+ * primitives drawn into the batch without building a shape.
+*/
+
+int total = 0;
+
+void setup() {
+  size(800, 600, P2D);
+}
+
+void draw() {
+  background(255);
+  fill(255, 200, 0, 40);
+  stroke(0, 40);
+  int start = millis();
+  for (int i = 0; i < 10000; i++) {
+    rect(random(width), random(height), random(5, 30), random(5, 30));
+    ellipse(random(width), random(height), random(5, 30), random(5, 30));
+  }
+  total += millis() - start;
+  if (frameCount % 60 == 0) {
+    fmt::print("10000 rects and 10000 ellipses in {:.2f}ms a frame\n", total / 60.0);
+    total = 0;
+  }
+}
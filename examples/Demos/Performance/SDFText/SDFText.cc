@@ -0,0 +1,46 @@
+/* SDFText
+ *
+ * Zooms and spins a line of text through a different text size every
+ * frame. With hint(ENABLE_SDF_TEXT) every size is drawn from one distance
+ * field atlas, so nothing is rasterized after the first frame and the
+ * edges stay sharp however large the text gets. Click to toggle SDF text
+ * and compare.
+*/
+
+bool sdf = true;
+
+void setup() {
+  size(640, 360);
+  textFont(createFont("SourceCodePro-Regular.ttf", 32));
+  textAlign(CENTER, CENTER);
+  hint(ENABLE_SDF_TEXT);
+}
+
+void mousePressed() {
+  sdf = !sdf;
+  hint(sdf ? ENABLE_SDF_TEXT : DISABLE_SDF_TEXT);
+}
+
+void draw() {
+  background(40);
+  int start = millis();
+  for (int i = 0; i < 20; i++) {
+    float zoom = 1.5 + sin(frameCount * 0.02 + i * 0.3);
+    textSize(int(8 + zoom * 20 + i));
+    if (i % 2 == 0) {
+      textOutline(color(255, 80, 0), 1.5);
+    } else {
+      noTextOutline();
+    }
+    pushMatrix();
+    translate(width/2, 20 + i * 17);
+    rotate(sin(frameCount * 0.01 + i) * 0.2);
+    scale(zoom);
+    fill(255);
+    text("Signed distance fields", 0, 0);
+    popMatrix();
+  }
+  if (frameCount % 60 == 0) {
+    fmt::print("{} text: {}ms per frame\n", sdf ? "SDF" : "Bitmap", millis() - start);
+  }
+}
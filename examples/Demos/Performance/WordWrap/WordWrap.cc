@@ -0,0 +1,66 @@
+/* WordWrap
+ *
+ * Greedily wraps a long paragraph at every width from 100 to 600 pixels,
+ * measuring each candidate line with textWidth(), and reports how long the
+ * measuring took before drawing the paragraph wrapped to the window.
+*/
+
+std::string paragraph =
+  "It was the best of times, it was the worst of times, it was the age of "
+  "wisdom, it was the age of foolishness, it was the epoch of belief, it was "
+  "the epoch of incredulity, it was the season of Light, it was the season of "
+  "Darkness, it was the spring of hope, it was the winter of despair, we had "
+  "everything before us, we had nothing before us, we were all going direct "
+  "to Heaven, we were all going direct the other way.";
+
+std::vector<std::string> wrap(const std::string &text, float maxWidth) {
+  std::vector<std::string> lines;
+  std::string line;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find(' ', start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string word = text.substr(start, end - start);
+    std::string candidate = line.empty() ? word : line + " " + word;
+    if (!line.empty() && textWidth(candidate) > maxWidth) {
+      lines.push_back(line);
+      line = word;
+    } else {
+      line = candidate;
+    }
+    start = end + 1;
+  }
+  if (!line.empty()) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+std::vector<std::string> lines;
+
+void setup() {
+  size(640, 360);
+  textFont(createFont("SourceCodePro-Regular.ttf", 16));
+
+  int start = millis();
+  int count = 0;
+  for (int w = 100; w <= 600; w++) {
+    count += wrap(paragraph, w).size();
+  }
+  fmt::print("Wrapped at 501 widths ({} lines) in {}ms\n", count, millis() - start);
+
+  lines = wrap(paragraph, width - 40);
+  noLoop();
+}
+
+void draw() {
+  background(255);
+  fill(0);
+  float y = 20;
+  for (auto &line : lines) {
+    text(line, 20, y + textAscent());
+    y += textAscent() + textDescent() + 4;
+  }
+}
@@ -59,6 +59,7 @@ extern PSurfaceMain surface;
 MAKE_GLOBAL(shader, surface.g);
 MAKE_GLOBAL(resetShader, surface.g);
 MAKE_GLOBAL(hint, surface.g);
+MAKE_GLOBAL(depthSortMillis, surface.g);
 MAKE_GLOBAL(get, surface.g);
 MAKE_GLOBAL(set, surface.g);
 MAKE_GLOBAL(saveFrame, surface.g);
@@ -93,6 +94,7 @@ MAKE_GLOBAL(noTexture, surface.g);
 MAKE_GLOBAL(box, surface.g);
 MAKE_GLOBAL(sphere, surface.g);
 MAKE_GLOBAL(sphereDetail, surface.g);
+MAKE_GLOBAL(circleDetail, surface.g);
 MAKE_GLOBAL(createBezier, surface.g);
 MAKE_GLOBAL(createRect, surface.g);
 MAKE_GLOBAL(createQuad, surface.g);
@@ -120,6 +122,8 @@ MAKE_GLOBAL(smooth, surface.g);
 MAKE_GLOBAL(noSmooth, surface.g);
 MAKE_GLOBAL(updatePixels, surface.g);
 MAKE_GLOBAL(textAlign, surface.g);
+MAKE_GLOBAL(textOutline, surface.g);
+MAKE_GLOBAL(noTextOutline, surface.g);
 MAKE_GLOBAL(text, surface.g);
 MAKE_GLOBAL(directionalLight, surface.g);
 MAKE_GLOBAL(ambientLight, surface.g);
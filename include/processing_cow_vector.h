@@ -0,0 +1,85 @@
+#ifndef PROCESSING_COW_VECTOR_H
+#define PROCESSING_COW_VECTOR_H
+
+#include <memory>
+#include <vector>
+
+// A std::vector shared between copies until one of them is modified.
+// Copying is O(1), the first non-const access to a shared vector makes a
+// private copy. Const access never copies, so reads should go through a
+// const reference where it matters.
+template <typename T>
+class cow_vector_t {
+   std::shared_ptr<std::vector<T>> data_;
+
+   static const std::vector<T> &none() {
+      static const std::vector<T> e;
+      return e;
+   }
+
+   std::vector<T> &write() {
+      if (!data_) {
+         data_ = std::make_shared<std::vector<T>>();
+      } else if (data_.use_count() > 1) {
+         data_ = std::make_shared<std::vector<T>>(*data_);
+      }
+      return *data_;
+   }
+
+public:
+   using value_type = T;
+   using const_iterator = typename std::vector<T>::const_iterator;
+   using iterator = typename std::vector<T>::iterator;
+
+   cow_vector_t() = default;
+
+   cow_vector_t(const std::vector<T> &v) : data_(std::make_shared<std::vector<T>>(v)) {}
+
+   cow_vector_t(std::vector<T> &&v) : data_(std::make_shared<std::vector<T>>(std::move(v))) {}
+
+   const std::vector<T> &read() const {
+      return data_ ? *data_ : none();
+   }
+
+   operator const std::vector<T> &() const {
+      return read();
+   }
+
+   bool shared() const {
+      return data_ && data_.use_count() > 1;
+   }
+
+   size_t size() const { return read().size(); }
+   bool empty() const { return read().empty(); }
+   const T &operator[](size_t i) const { return read()[i]; }
+   const T &back() const { return read().back(); }
+   const T *data() const { return read().data(); }
+   const_iterator begin() const { return read().begin(); }
+   const_iterator end() const { return read().end(); }
+
+   T &operator[](size_t i) { return write()[i]; }
+   T &back() { return write().back(); }
+   T *data() { return write().data(); }
+   iterator begin() { return write().begin(); }
+   iterator end() { return write().end(); }
+
+   void push_back(const T &x) { write().push_back(x); }
+   void push_back(T &&x) { write().push_back(std::move(x)); }
+
+   template <typename... Args>
+   T &emplace_back(Args &&...args) { return write().emplace_back(std::forward<Args>(args)...); }
+
+   void reserve(size_t n) { write().reserve(n); }
+   void resize(size_t n) { write().resize(n); }
+
+   // Dropping our reference is enough, no need to copy what's being thrown away.
+   void clear() {
+      if (shared()) {
+         data_.reset();
+      } else if (data_) {
+         data_->clear();
+      }
+   }
+};
+
+#endif
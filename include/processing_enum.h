@@ -92,6 +92,16 @@ enum {
    IMAGE,
    SSAA,
    MSAA,
+
+   DISABLE_DEPTH_SORT,
+   ENABLE_DEPTH_SORT,
+   DISABLE_SDF_TEXT,
+   ENABLE_SDF_TEXT,
+   DISABLE_FRUSTUM_CULLING,
+   ENABLE_FRUSTUM_CULLING,
+
+   BOTTOM,
+   BASELINE,
 };
 
 
@@ -0,0 +1,75 @@
+#ifndef PROCESSING_MAPPED_FILE_H
+#define PROCESSING_MAPPED_FILE_H
+
+#include <fmt/core.h>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read only view of a whole file, memory mapped where the platform lets us.
+class mapped_file_t {
+   const char *data = nullptr;
+   size_t size = 0;
+#ifdef _WIN32
+   std::string buffer;
+#endif
+
+public:
+   explicit mapped_file_t(const std::string &path) {
+#ifdef _WIN32
+      std::ifstream file(path, std::ios::binary);
+      if (!file.is_open()) {
+         fmt::print("Failed to open file: {}\n", path);
+         abort();
+      }
+      buffer.assign( std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() );
+      data = buffer.data();
+      size = buffer.size();
+#else
+      int fd = open( path.c_str(), O_RDONLY );
+      struct stat st;
+      if (fd < 0 || fstat( fd, &st ) != 0) {
+         fmt::print("Failed to open file: {}\n", path);
+         abort();
+      }
+      size = st.st_size;
+      if (size > 0) {
+         void *p = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+         if (p == MAP_FAILED) {
+            fmt::print("Failed to map file: {}\n", path);
+            abort();
+         }
+         madvise( p, size, MADV_SEQUENTIAL );
+         data = (const char *)p;
+      }
+      close( fd );
+#endif
+   }
+
+   ~mapped_file_t() {
+#ifndef _WIN32
+      if (data) {
+         munmap( (void *)data, size );
+      }
+#endif
+   }
+
+   mapped_file_t(const mapped_file_t &) = delete;
+   mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+   std::string_view view() const {
+      return { data, size };
+   }
+};
+
+#endif
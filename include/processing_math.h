@@ -10,6 +10,8 @@
 #include <cstdlib>
 #include <random>
 #include <array>
+#include <algorithm>
+#include <vector>
 #include <fmt/core.h>
 
 #include <glm/vec3.hpp>
@@ -544,6 +546,53 @@ inline PMatrix RotateMatrix(const float angle, const PVector& in) {
    return ret;
 }
 
+// Tolerance in pixels used when flattening curves into line segments.
+constexpr float CURVE_TOLERANCE = 0.25F;
+
+// Largest factor by which a matrix can stretch a length, good enough to
+// turn a tolerance in pixels into one in the matrix's local units.
+inline float maxScale(const PMatrix &m) {
+   const auto &d = m.glm_data();
+   float s = std::max( { glm::dot( glm::vec3(d[0]), glm::vec3(d[0]) ),
+                         glm::dot( glm::vec3(d[1]), glm::vec3(d[1]) ),
+                         glm::dot( glm::vec3(d[2]), glm::vec3(d[2]) ) } );
+   return s > 0.0F ? std::sqrt(s) : 1.0F;
+}
+
+// Number of equal steps in t needed to draw a curve as a polyline staying
+// within tolerance of it, given a bound on the magnitude of the curve's
+// second derivative. Linear interpolation over a step h is off by at most
+// h * h * max_accel / 8.
+inline int curveSegments(float max_accel, float tolerance, int max_segments = 100) {
+   float n = std::ceil( std::sqrt( max_accel / (8.0F * tolerance) ) );
+   return std::clamp( (int)n, 1, max_segments );
+}
+
+inline int bezierSegmentsQuadratic(const PVector &a, const PVector &b, const PVector &c, float tolerance) {
+   return curveSegments( 2.0F * (a - 2 * b + c).mag(), tolerance );
+}
+
+inline int bezierSegmentsCubic(const PVector &a, const PVector &b, const PVector &c, const PVector &d, float tolerance) {
+   return curveSegments( 6.0F * std::max( (a - 2 * b + c).mag(), (b - 2 * c + d).mag() ), tolerance );
+}
+
+// Number of segments to draw a full circle of the given radius in pixels
+// with, keeping within tolerance of the true circle. Rounded up to a power
+// of two so only a handful of sin/cos tables are ever needed.
+inline int circleSegments(float radius, int min_segments, int max_segments, float tolerance = CURVE_TOLERANCE) {
+   float n = std::numbers::pi_v<float> * std::sqrt( std::max( radius, 0.0F ) / (2.0F * tolerance) );
+   int segments = min_segments;
+   while ( segments < n && segments < max_segments ) {
+      segments *= 2;
+   }
+   return std::min( segments, max_segments );
+}
+
+// Cosine and sine of 2 * PI * i / segments for i in [0, segments], so the
+// last entry wraps back round to the first. Tables are built once per
+// segment count and live for the rest of the program.
+const std::vector<std::array<float,2>> &sinCosTable(int segments);
+
 inline float map(float value, float fromLow, float fromHigh, float toLow, float toHigh) {
    float result = (value - fromLow) * (toHigh - toLow) / (fromHigh - fromLow) + toLow;
    return result;
@@ -2,11 +2,14 @@
 #define PROCESSING_OPENGL_H
 
 #include <vector>
+#include <iosfwd>
+#include <string_view>
 #include <fmt/core.h>
 
 #include "processing_opengl_shader.h"
 #include "processing_opengl_texture.h"
 #include "processing_opengl_color.h"
+#include "processing_opengl_mesh.h"
 #include "processing_utils.h"
 #include "processing_enum.h"
 #include "processing_math.h"
@@ -15,6 +18,8 @@
 typedef int GLint;
 typedef unsigned int GLuint;
 
+class PShapeImpl;
+
 
 namespace gl {
 
@@ -67,12 +72,16 @@ namespace gl {
 
    public:
       int blendMode( int b );
+      int getBlendMode() const;
       void hint(int type);
 
       scene_t();
       void setup( const shader_t &shader);
       float screenX(float x, float y, float z) const;
       float screenY(float x, float y, float z) const;
+      float pixelScale(const glm::vec3 &world, int viewport_height) const;
+      glm::mat4 projectionView() const;
+      const glm::mat4 &viewMatrix() const;
       void set();
       void setProjectionMatrix( const glm::mat4 &PV );
       void setViewMatrix( const glm::mat4 &PV );
@@ -89,6 +98,9 @@ namespace gl {
 
    typedef std::shared_ptr<VAO_t>  VAO_t_ptr;
 
+   class batch_t;
+   typedef std::shared_ptr<batch_t>  batch_t_ptr;
+
    class batch_t {
       attribute_t Position;
       attribute_t Normal;
@@ -101,10 +113,28 @@ namespace gl {
       uniform_t TexOffset;
       attribute_t Ambient, Specular, Emissive, Shininess;
       std::vector<VAO_t_ptr> vaos;
+      VAO_t_ptr spare;
+      struct palette_patch_t {
+         int vao;
+         int slot;
+         glm::mat4 transform;
+      };
+      std::vector<palette_patch_t> palette_patches;
       bool uses_textures = false;
       bool uses_circles = false;
 
+      VAO_t_ptr newVAO();
+
    public:
+      // A run of vertices and indices within one VAO of the batch.
+      struct span_t {
+         int vao = 0;
+         int vertex = 0;
+         int vertices = 0;
+         int index = 0;
+         int indices = 0;
+      };
+
       batch_t() noexcept {}
 
       batch_t(const batch_t& x) noexcept = default;
@@ -126,11 +156,44 @@ namespace gl {
       bool usesCircles() const;
       bool usesTextures() const;
 
+      // Support for updating compiled batches in place. mark() and spans()
+      // record where a piece of geometry lands, patch() overwrites those
+      // vertices with the contents of a scratch batch provided the layout
+      // is unchanged and loadPatches() uploads just the modified ranges.
+      span_t mark() const;
+      std::vector<span_t> spans(const span_t &from) const;
+      bool patch(const std::vector<span_t> &spans, const batch_t &source);
+      // Start a new transform palette entry for the geometry that follows,
+      // or replace the entry used by previously recorded spans.
+      void transform(const glm::mat4 &transform);
+      void transform(const std::vector<span_t> &spans, const glm::mat4 &transform);
+      void rewind();
+      // Weld duplicate vertices and reorder for the vertex caches. This
+      // invalidates any spans taken from the batch.
+      mesh_stats_t optimize();
+      // Remove every triangle with a translucent vertex and return them in
+      // a new batch sorted back to front, or nullptr if there were none.
+      batch_t_ptr extractTranslucent(const glm::mat4 &view);
+      void loadPatches();
+
+      // Write out everything needed to draw the batch, textures included,
+      // and read it back. read() returns false if data isn't a whole batch.
+      void write(std::ostream &out) const;
+      bool read(std::string_view data);
+
       void vertices( const std::vector<vertex_t> &vertices,const std::vector<material_t> &materials,  const std::vector<unsigned short> &indices,
                      const glm::mat4 &transform, bool flatten_transform, std::optional<texture_t_ptr> texture, std::optional<color_t> override );
-   };
 
-   typedef std::shared_ptr<batch_t>  batch_t_ptr;
+      // Space for whatever is building geometry to go into the batch to
+      // reuse between calls, rather than keeping its own in globals.
+      struct scratch_t {
+         std::vector<vertex_t> vertices;
+         std::vector<material_t> materials;
+         std::vector<unsigned short> indices;
+         std::shared_ptr<PShapeImpl> stroke;
+      };
+      scratch_t scratch;
+   };
 
    class framebuffer_t;
    class frame_t {
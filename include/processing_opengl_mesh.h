@@ -0,0 +1,40 @@
+#ifndef PROCESSING_OPENGL_MESH_H
+#define PROCESSING_OPENGL_MESH_H
+
+#include <cstdint>
+#include <vector>
+
+namespace gl {
+
+   // What optimizing a batch achieved. ACMR is the average number of
+   // vertices the GPU has to transform per triangle with a small FIFO
+   // post-transform cache, 3.0 is the worst case and ~0.6 is about as good
+   // as a regular grid gets.
+   struct mesh_stats_t {
+      int vertices_before = 0;
+      int vertices_after = 0;
+      int triangles = 0;
+      float acmr_before = 0.0F;
+      float acmr_after = 0.0F;
+   };
+
+   // Simulated cache misses per triangle for an indexed triangle list.
+   float acmr(const std::vector<unsigned short> &indices, int cache_size = 32);
+
+   // Reorder triangles so that consecutive triangles share vertices that
+   // are still in the post-transform cache, using Tom Forsyth's linear
+   // speed vertex cache optimisation.
+   void optimizeVertexCache(std::vector<unsigned short> &indices, int vertex_count);
+
+   // Renumber vertices in the order they are first used so vertex fetches
+   // walk memory sequentially. Returns the old index of each new vertex,
+   // vertices nothing refers to are dropped.
+   std::vector<int> optimizeVertexFetch(std::vector<unsigned short> &indices, int vertex_count);
+
+   // Indices of depths in ascending order, farthest first for view space
+   // depths. A stable LSD radix sort, split across threads for large inputs.
+   std::vector<uint32_t> depthOrder(const std::vector<float> &depths);
+
+} // namespace gl
+
+#endif
@@ -54,6 +54,8 @@ namespace gl {
 
       GLuint get_id() const;
 
+      GLint get_wrap() const;
+
       void bind() const;
 
       operator bool() const;
@@ -25,11 +25,61 @@ public:
 
    PFont(const char *name_, int size_);
 
+   // Also renders every character in charset, UTF-8, into the glyph atlas
+   // up front on several threads so the first frame to show them doesn't
+   // stall.
+   PFont(const char *name_, int size_, std::string_view charset);
+
+   // Printable ASCII, a reasonable charset to prerasterize.
+   static constexpr std::string_view CHARSET =
+      " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~";
+
    const char *getName() const;
+   int getSize() const;
 
    PShape render_as_pshape(std::string_view text) const;
    PImage render_as_pimage(std::string_view text);
 
+   // One glyph of laid out text. Positions are in pixels relative to the
+   // start of the first line's baseline, texture coordinates are into page,
+   // one of the font's glyph atlas pages. With sdf the page is a signed
+   // distance field shared by every size of the face, the edge is at alpha
+   // 0.5.
+   struct glyph_quad_t {
+      PImage page;
+      PVector2 topLeft;
+      PVector2 bottomRight;
+      PVector2 uvTopLeft;
+      PVector2 uvBottomRight;
+   };
+
+   std::vector<glyph_quad_t> layout(std::string_view text, bool sdf = false);
+
+   // Text word wrapped into a width by height box and aligned within it,
+   // positions are relative to the box's top left corner. Layouts are
+   // cached so the result is only valid until the next call.
+   const std::vector<glyph_quad_t> &layout(std::string_view text, float width, float height,
+                                           int align_x, int align_y, bool sdf = false);
+
+   // Distance fields are rendered at this pixel size and reach this many
+   // pixels either side of the outline.
+   static constexpr int SDFReferenceSize = 64;
+   static constexpr int SDFSpread = 8;
+
+   // Strings rendered to images are cached per font, least recently used
+   // first out once the cache exceeds its budget. Bytes count both the
+   // pixels and the texture.
+   struct cache_stats_t {
+      size_t hits = 0;
+      size_t misses = 0;
+      size_t evictions = 0;
+      size_t entries = 0;
+      size_t bytes = 0;
+   };
+
+   static void setWordCacheBudget(size_t bytes);
+   cache_stats_t wordCacheStats() const;
+
    float textAscent() const;
    float textDescent() const;
    float textWidth(std::string_view text);
@@ -41,6 +91,10 @@ inline PFont createFont(const char *name, int size) {
    return {name, size};
 }
 
+inline PFont createFont(const char *name, int size, std::string_view charset) {
+   return {name, size, charset};
+}
+
 void textFont(PFont font);
 void textSize(int size);
 
@@ -120,11 +120,18 @@ public:
 
    void hint(int type);
 
+   // Time spent depth sorting translucent triangles in the last frame.
+   float depthSortMillis() const;
+
    float textAscent();
    float textDescent();
 
    float textWidth(const std::string &text);
 
+   // Outline drawn around SDF text, see hint(ENABLE_SDF_TEXT).
+   void textOutline(color c, float weight);
+   void noTextOutline();
+
    void text(const std::string &text, float x, float y, float twidth = -1, float theight = -1);
    void text(char c, float x, float y, float twidth = -1, float theight = -1) ;
 
@@ -148,6 +155,8 @@ public:
 
    void sphereDetail(float res);
 
+   void circleDetail(int minSegments, int maxSegments);
+
    PShape createSphere( float radius );
 
    void sphere(float radius);
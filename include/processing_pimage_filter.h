@@ -0,0 +1,32 @@
+#ifndef PROCESSING_PIMAGE_FILTER_H
+#define PROCESSING_PIMAGE_FILTER_H
+
+#include <cstdint>
+
+// Filters for PImage::filter() working in place on RGBA pixels, red in
+// the low byte and alpha in the high byte. Large images are split into
+// bands across threads, and the point filters use the widest SIMD the
+// CPU supports, picked when first used.
+
+void filterGray(uint32_t *pixels, int width, int height);
+
+// Pixels whose average of red, green and blue is above level go white,
+// the rest black.
+void filterThreshold(uint32_t *pixels, int width, int height, float level);
+
+void filterOpaque(uint32_t *pixels, int width, int height);
+
+void filterInvert(uint32_t *pixels, int width, int height);
+
+// Limits each channel to levels values, clamped to 2 to 255.
+void filterPosterize(uint32_t *pixels, int width, int height, int levels);
+
+// Replace each pixel with its darkest, or for dilate brightest, four
+// connected neighbour when that's darker, or brighter, than it is.
+void filterErode(uint32_t *pixels, int width, int height);
+void filterDilate(uint32_t *pixels, int width, int height);
+
+// Kernels in use, "avx2", "sse2" or "scalar".
+const char *filterKernels();
+
+#endif
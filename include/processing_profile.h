@@ -4,6 +4,7 @@
 #include <string>
 #include <chrono>
 #include <fstream>
+#include <mutex>
 #include <thread>
 
 namespace Profile {
@@ -27,6 +28,8 @@ namespace Profile {
    {
    private:
       std::ofstream m_OutputStream;
+      // Scopes on worker threads finish concurrently.
+      std::mutex m_Lock;
       int m_ProfileCount;
       long long m_Start;
       std::string m_Name;
@@ -50,6 +53,7 @@ namespace Profile {
       }
 
       void WriteProfile(const Result& result) {
+         std::lock_guard<std::mutex> guard(m_Lock);
          if (m_ProfileCount++ > 0)
             m_OutputStream << ",";
 
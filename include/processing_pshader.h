@@ -73,6 +73,7 @@ public:
 
 };
 PShader loadFlatShader();
+PShader loadSDFShader();
 PShader directShader();
 PShader loadShader();
 PShader loadShader(const char *fragShader);
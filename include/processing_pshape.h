@@ -6,6 +6,7 @@
 #include "processing_enum.h"
 #include "processing_pimage.h"
 #include "processing_java_compatability.h"
+#include "processing_opengl_mesh.h"
 
 #include <vector>
 #include <string_view>
@@ -24,10 +25,11 @@ class PShape {
    std::shared_ptr<PShapeImpl> impl;
    PShape( std::shared_ptr<PShapeImpl> impl_ );
    friend PShape createShape();
+   friend PShape loadCompiled(std::string_view path, std::string_view source);
+   friend void drawUntexturedFilledEllipse(PShape &shape, float x, float y, float width, float height, color color, const PMatrix &transform);
  public:
    static void init();
    static void optimize();
-   static void gc();
    static void close();
 
    float width=0, height=0;
@@ -42,6 +44,10 @@ class PShape {
       return !(x==*this);
    };
 
+   explicit operator bool() const {
+      return impl != nullptr;
+   }
+
    struct vInfoExtra {
       color stroke;
       float weight;
@@ -72,9 +78,15 @@ class PShape {
    void disableStyle();
 
    void copyStyle( const PShape other );
+   void restyle( const PShape other, float weight_scale = 1.0F );
+   bool sameStyle( const PShape other ) const;
 
    void clear();
 
+   // Return to the state of a newly created shape while keeping the
+   // storage already allocated, for reusing one shape as scratch space.
+   void reset();
+
    void rotate(float angle);
 
    void rotateZ(float angle);
@@ -147,6 +159,8 @@ class PShape {
 
    void bezierVertexQuadratic(PVector control, PVector anchor2);
 
+   void setCurveTolerance(float tolerance);
+
    void curveTightness(float alpha);
 
    void curveVertex(PVector c);
@@ -228,13 +242,28 @@ class PShape {
 
    void setTint(color c);
 
+   // Optimizing welds duplicate vertices and reorders triangles for the
+   // vertex cache, worth it for static meshes drawn often. Any later change
+   // to an optimized shape rebuilds it. compile() with no argument keeps
+   // whichever the shape was last compiled with, unoptimized at first.
    void compile();
+   void compile(bool optimize);
+
+   const gl::mesh_stats_t &compileStats() const;
 
    bool isCompiled() const;
 
+   bool updateCompiled();
+
    gl::batch_t_ptr getBatch();
 
-   void flatten(gl::batch_t_ptr parent_batch, const PMatrix& transform, bool flatten_transforms) const;
+   // With view_projection set, subtrees whose bounds fall outside the view
+   // frustum are skipped.
+   void flatten(gl::batch_t_ptr parent_batch, const PMatrix& transform, bool flatten_transforms, const PMatrix *view_projection = nullptr) const;
+
+   // True if clip, taking the shape's parent coordinates to clip space,
+   // puts the whole shape outside the view frustum.
+   bool outsideFrustum(const PMatrix &clip) const;
 
    void draw_normals(gl::batch_t_ptr parent_batch, const PMatrix& transform, bool flatten_transforms) const;
 
@@ -242,6 +271,10 @@ class PShape {
 
    void draw_fill(gl::batch_t_ptr parent_batch, const PMatrix& transform, bool flatten_transforms) const;
 
+   // Draw a closed convex polygon in this shape's untextured style straight
+   // into the batch, as immediate mode does for rect() and ellipse().
+   void draw_convex(gl::batch_t_ptr parent_batch, const PMatrix& transform, const std::vector<PVector> &points, std::optional<PVector> normal = {}) const;
+
    int getChildCount() const;
 
    int getVertexCount() const;
@@ -250,6 +283,11 @@ class PShape {
 
    PShape copy() const;
 
+   // Compile the shape and save the result to a file that loadCompiled()
+   // can read back without redoing any parsing or tessellation. If a source
+   // file is given the cache is only used while that file is unchanged.
+   void saveCompiled(std::string_view path, std::string_view source = {});
+
    void setVertex(int i, PVector v);
 
    void setVertex(int i, float x, float y , float z = 0);
@@ -261,9 +299,14 @@ class PShape {
 
 PVector fast_ellipse_point(const PVector &center, int index, float xradius, float yradius);
 PShape drawUntexturedFilledEllipse(float x, float y, float width, float height, color color, const PMatrix &transform);
+void drawUntexturedFilledEllipse(PShape &shape, float x, float y, float width, float height, color color, const PMatrix &transform);
 
 PShape loadShapeOBJ(std::string_view objPath);
 PShape loadShape(std::string_view objPath);
+// Returns an empty shape if the file is missing, stale or unreadable.
+PShape loadCompiled(std::string_view path, std::string_view source = {});
+// loadShape() the source, reusing a compiled copy saved at path if possible.
+PShape loadShapeCompiled(std::string_view source, std::string_view path);
 PShape createShape();
 
 #endif
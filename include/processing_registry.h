@@ -0,0 +1,85 @@
+#ifndef PROCESSING_REGISTRY_H
+#define PROCESSING_REGISTRY_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Intrusive list of every live instance of T. Deriving from registered_t<T>
+// links an object in when it's constructed and unlinks it in O(1) when it's
+// destroyed, so keeping track of instances costs no allocation. Used at
+// shutdown to find everything holding GL or FreeType resources.
+template <typename T>
+class registered_t : public std::enable_shared_from_this<T> {
+   registered_t *prev = nullptr;
+   registered_t *next = nullptr;
+
+   static registered_t *&head() {
+      static registered_t *h = nullptr;
+      return h;
+   }
+
+   static std::mutex &lock() {
+      static std::mutex m;
+      return m;
+   }
+
+   void link() {
+      std::lock_guard<std::mutex> guard(lock());
+      next = head();
+      if (next) {
+         next->prev = this;
+      }
+      head() = this;
+   }
+
+   void unlink() {
+      std::lock_guard<std::mutex> guard(lock());
+      if (prev) {
+         prev->next = next;
+      } else {
+         head() = next;
+      }
+      if (next) {
+         next->prev = prev;
+      }
+   }
+
+protected:
+   registered_t() {
+      link();
+   }
+
+   registered_t(const registered_t &) : std::enable_shared_from_this<T>() {
+      link();
+   }
+
+   registered_t &operator=(const registered_t &) {
+      return *this;
+   }
+
+   ~registered_t() {
+      unlink();
+   }
+
+public:
+   // Call f on every instance owned by a shared_ptr. References are taken
+   // up front so f is free to create or destroy instances.
+   template <typename F>
+   static void for_each(F &&f) {
+      std::vector<std::shared_ptr<T>> all;
+      {
+         std::lock_guard<std::mutex> guard(lock());
+         for (auto *i = head(); i; i = i->next) {
+            if (auto p = static_cast<T*>(i)->weak_from_this().lock()) {
+               all.push_back(std::move(p));
+            }
+         }
+      }
+      for (auto &p : all) {
+         f(*p);
+      }
+   }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PROCESSING_UNICODE_H
+#define PROCESSING_UNICODE_H
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+constexpr char32_t ReplacementCharacter = 0xFFFD;
+
+// Decodes the UTF-8 sequence starting at text[i] and moves i past it.
+// Malformed, overlong or truncated sequences come back as U+FFFD having
+// consumed a single byte so decoding picks up again at the next one.
+inline char32_t nextCodepoint(std::string_view text, size_t &i) {
+   unsigned char lead = text[i++];
+   if (lead < 0x80) {
+      return lead;
+   }
+   int length;
+   char32_t c;
+   if ((lead & 0xE0) == 0xC0) {
+      length = 1;
+      c = lead & 0x1F;
+   } else if ((lead & 0xF0) == 0xE0) {
+      length = 2;
+      c = lead & 0x0F;
+   } else if ((lead & 0xF8) == 0xF0) {
+      length = 3;
+      c = lead & 0x07;
+   } else {
+      return ReplacementCharacter;
+   }
+   if (i + length > text.size()) {
+      return ReplacementCharacter;
+   }
+   for (int k = 0; k < length; ++k) {
+      unsigned char next = text[i + k];
+      if ((next & 0xC0) != 0x80) {
+         return ReplacementCharacter;
+      }
+      c = (c << 6) | (next & 0x3F);
+   }
+   static constexpr char32_t smallest[] = { 0, 0x80, 0x800, 0x10000 };
+   if (c < smallest[length] || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+      return ReplacementCharacter;
+   }
+   i += length;
+   return c;
+}
+
+// Values looked up by codepoint. The Basic Multilingual Plane is a flat
+// table split into pages of 256 that are allocated the first time
+// anything in them is stored, so a lookup is two array indexes. Anything
+// beyond the BMP falls back to a hash map.
+template <typename T>
+class codepoint_table_t {
+   static constexpr char32_t PageBits = 8;
+   static constexpr char32_t PageSize = 1 << PageBits;
+   static constexpr char32_t Pages = 0x10000 >> PageBits;
+
+   using page_t = std::array<std::optional<T>, PageSize>;
+   std::array<std::unique_ptr<page_t>, Pages> pages;
+   std::unordered_map<char32_t, T> others;
+
+public:
+   T *find(char32_t c) {
+      if (c < 0x10000) {
+         auto &page = pages[c >> PageBits];
+         if (page) {
+            auto &value = (*page)[c & (PageSize - 1)];
+            return value ? &*value : nullptr;
+         }
+         return nullptr;
+      }
+      auto other = others.find( c );
+      return other == others.end() ? nullptr : &other->second;
+   }
+
+   const T *find(char32_t c) const {
+      return const_cast<codepoint_table_t *>(this)->find( c );
+   }
+
+   T &insert(char32_t c, T value) {
+      if (c < 0x10000) {
+         auto &page = pages[c >> PageBits];
+         if (!page) {
+            page = std::make_unique<page_t>();
+         }
+         return (*page)[c & (PageSize - 1)].emplace( std::move(value) );
+      }
+      return others.insert_or_assign( c, std::move(value) ).first->second;
+   }
+
+   void clear() {
+      for (auto &page : pages) {
+         page.reset();
+      }
+      others.clear();
+   }
+};
+
+#endif
@@ -130,7 +130,6 @@ int main(int argc, char* argv[]) {
             xloop--;
          }
       }
-      PShape::gc();
       auto endTicks = std::chrono::high_resolution_clock::now();
       unsigned int actualFrameTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTicks - startTicks).count();
 
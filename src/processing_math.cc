@@ -4,6 +4,8 @@
 
 #include <fmt/core.h>
 #include <cmath>
+#include <map>
+#include <mutex>
 
 int perlin_noise_seed = 0;
 int perlin_octaves = 4 ;
@@ -35,6 +37,26 @@ float noise(float x, float y, float z) {
    return total/maxValue;
 }
 
+const std::vector<std::array<float,2>> &sinCosTable(int segments) {
+   static std::map<int, std::vector<std::array<float,2>>> tables;
+   static std::mutex mutex;
+   if (segments < 1) {
+      fmt::print("Invalid number of circle segments {}\n", segments);
+      abort();
+   }
+   std::lock_guard<std::mutex> lock(mutex);
+   auto &table = tables[segments];
+   if (table.empty()) {
+      table.reserve(segments + 1);
+      for (int i = 0; i < segments; ++i) {
+         double angle = 2.0 * std::numbers::pi * i / segments;
+         table.push_back( { (float)std::cos(angle), (float)std::sin(angle) } );
+      }
+      table.push_back( table.front() );
+   }
+   return table;
+}
+
 void PMatrix::print() const {
    if ( identity ) {
       fmt::print("Identity\n");
@@ -5,10 +5,15 @@
 
 #include "processing_opengl.h"
 #include "processing_opengl_framebuffer.h"
+#include "processing_opengl_mesh.h"
 #include "processing_debug.h"
 #include "processing_task_queue.h"
 
 #include <glm/gtc/type_ptr.hpp>
+#include <cstring>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
 
 #undef DEBUG_METHOD
 #undef DEBUG_METHOD_MESSAGE
@@ -17,6 +22,13 @@
 
 progschj::ThreadPool renderThread(1);
 
+// Do this better and share somehow with shader and texture unit init
+// code.
+// glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &MaxTextureImageUnits);
+
+static const int MaxTextureImageUnits = 15; // keep one spare
+static const int MaxTransformsPerBatch = 16;
+
 static bool enable_debug = false;
 
 namespace gl {
@@ -26,6 +38,16 @@ namespace gl {
       GLuint indexId = 0;
       GLuint vertexId = 0;
       GLuint materialId= 0;
+      // Range of vertices changed by batch_t::patch since the last upload.
+      int patch_begin = 0;
+      int patch_end = 0;
+      // Matrices uploaded by the last draw, reused while neither the
+      // transform nor the palette changes.
+      glm::mat4 drawn_transform;
+      std::vector<glm::mat4> drawn_palette;
+      std::vector<glm::mat4> drawn_transforms;
+      std::vector<glm::mat3> drawn_normals;
+      void genBuffers();
    public:
       friend struct fmt::formatter<VAO_t>;
 
@@ -50,7 +72,19 @@ namespace gl {
                  attribute_t Coord,    attribute_t TUnit,  attribute_t MIndex,
                  attribute_t Ambient,  attribute_t Specular, attribute_t Emissive, attribute_t Shininess);
       int hasTexture(texture_t_ptr texture);
-      void loadBuffers() const;
+      void loadBuffers();
+      // Vertices changed by patch(), copied so the render thread can
+      // upload them while the originals go on being patched.
+      struct upload_t {
+         int begin;
+         std::vector<vertex_t> vertices;
+         std::vector<material_t> materials;
+      };
+      void patch(int begin, int end);
+      std::optional<upload_t> takePatch();
+      void loadPatch(const upload_t &upload);
+      void optimize(mesh_stats_t &stats);
+      void setMatrices(const uniform_t &Mmatrix, const uniform_t &Nmatrix, const glm::mat4 &transform);
       void draw() const;
       void debugPrint() const;
       ~VAO_t();
@@ -60,6 +94,10 @@ namespace gl {
       return std::exchange(currentBlendMode,b);
    }
 
+   int scene_t::getBlendMode() const {
+      return currentBlendMode;
+   }
+
    void scene_t::hint(int type) {
       switch(type) {
       case DISABLE_DEPTH_TEST:
@@ -104,6 +142,22 @@ namespace gl {
       return (projection_matrix * (view_matrix * in)).y;
    }
 
+   // How many pixels one unit of length at the given world position covers
+   // once projected onto a viewport of the given height.
+   float scene_t::pixelScale(const glm::vec3 &world, int viewport_height) const {
+      glm::vec4 clip = projection_matrix * (view_matrix * glm::vec4{ world, 1 });
+      float w = std::abs(clip.w) > 1e-6F ? std::abs(clip.w) : 1e-6F;
+      return std::abs(projection_matrix[1][1]) * viewport_height / 2.0F / w;
+   }
+
+   glm::mat4 scene_t::projectionView() const {
+      return projection_matrix * view_matrix;
+   }
+
+   const glm::mat4 &scene_t::viewMatrix() const {
+      return view_matrix;
+   }
+
    void scene_t::set() {
       PVmatrix.set( projection_matrix * view_matrix  );
       Eye.set( glm::vec3(glm::inverse(view_matrix)[3]));
@@ -346,14 +400,8 @@ namespace gl {
          fmt::print("\n### GEOMETRY DUMP END   ###\n");
       }
 
-      std::vector<glm::mat4> transforms;
-      std::vector<glm::mat3> normals;
-      transforms.push_back(transform);
-      normals.emplace_back( glm::transpose(glm::inverse(transform)) );
-      Mmatrix.set( transforms );
-      Nmatrix.set( normals );
-
       for (auto &draw: vaos ) {
+         draw->setMatrices( Mmatrix, Nmatrix, transform );
          setupTextures( draw );
          draw->draw();
       }
@@ -372,13 +420,6 @@ namespace gl {
          }
       }
 
-      // Do this better and share somehow with shader and texture unit init
-      // code.
-      // glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &MaxTextureImageUnits);
-
-      const int MaxTextureImageUnits = 15; // keep one spare
-      const int MaxTransformsPerBatch = 16;
-
       if (vertices.size() > 65536)
          abort();
 
@@ -387,7 +428,7 @@ namespace gl {
          flatten_transforms ? I : transform_;
 
       if (vaos.size() == 0 || vaos.back()->vertices.size() + vertices.size() > 65536) {
-         vaos.emplace_back(std::make_shared<VAO_t>());
+         vaos.emplace_back(newVAO());
          vaos.back()->transforms.push_back( transform );
          vaos.back()->textures.push_back(texture_.value());
       }
@@ -396,7 +437,7 @@ namespace gl {
 
       if ( transform != vaos.back()->transforms.back()) {
          if (vaos.back()->transforms.size() == MaxTransformsPerBatch) {
-            vaos.emplace_back(std::make_shared<VAO_t>());
+            vaos.emplace_back(newVAO());
             vaos.back()->textures.push_back(texture_.value());
          }
          vaos.back()->transforms.push_back(transform);
@@ -415,7 +456,7 @@ namespace gl {
 
          if ( i == vec.end() ) {
             if (vec.size() == MaxTextureImageUnits) {
-               vaos.emplace_back(std::make_shared<VAO_t>());
+               vaos.emplace_back(newVAO());
                vaos.back()->transforms.push_back( transform );
             }
             // Old version of vec might have been invalidated.
@@ -450,6 +491,39 @@ namespace gl {
       }
    }
 
+   // The shader normalizes normals after transforming them, so when the
+   // upper 3x3 is a rotation with a uniform scale it can be used as is and
+   // only shears and non-uniform scales need the inverse transpose.
+   static glm::mat3 normalMatrix(const glm::mat4 &transform) {
+      glm::mat3 m( transform );
+      float x = glm::dot( m[0], m[0] );
+      float y = glm::dot( m[1], m[1] );
+      float z = glm::dot( m[2], m[2] );
+      float eps = 1e-5F * (x + y + z);
+      if (std::abs( x - y ) < eps && std::abs( y - z ) < eps &&
+          std::abs( glm::dot( m[0], m[1] ) ) < eps &&
+          std::abs( glm::dot( m[0], m[2] ) ) < eps &&
+          std::abs( glm::dot( m[1], m[2] ) ) < eps) {
+         return m;
+      }
+      return glm::transpose( glm::inverse( m ) );
+   }
+
+   void VAO_t::setMatrices(const uniform_t &Mmatrix, const uniform_t &Nmatrix, const glm::mat4 &transform) {
+      if (drawn_transforms.empty() || transform != drawn_transform || transforms != drawn_palette) {
+         drawn_transform = transform;
+         drawn_palette = transforms;
+         drawn_transforms.clear();
+         drawn_normals.clear();
+         for ( const auto &palette : transforms ) {
+            drawn_transforms.push_back( transform * palette );
+            drawn_normals.push_back( normalMatrix( drawn_transforms.back() ) );
+         }
+      }
+      Mmatrix.set( drawn_transforms );
+      Nmatrix.set( drawn_normals );
+   }
+
    void VAO_t::debugPrint() const {
       for (const auto &m : transforms) {
          fmt::print("{}\n",m);
@@ -476,14 +550,7 @@ namespace gl {
       }
 
       for (auto &draw: vaos ) {
-         std::vector<glm::mat3> normals;
-         for ( const auto &transform : draw->transforms ) {
-            normals.emplace_back( glm::transpose(glm::inverse(transform)) );
-         }
-
-         Mmatrix.set( draw->transforms );
-         Nmatrix.set(normals);
-
+         draw->setMatrices( Mmatrix, Nmatrix, glm::identity<glm::mat4>() );
          setupTextures( draw );
          draw->draw();
       }
@@ -512,6 +579,275 @@ namespace gl {
       renderThread.wait_until_nothing_in_flight();
    }
 
+   batch_t::span_t batch_t::mark() const {
+      if (vaos.empty()) {
+         return {};
+      }
+      return { (int)vaos.size() - 1, (int)vaos.back()->vertices.size(), 0,
+               (int)vaos.back()->indices.size(), 0 };
+   }
+
+   std::vector<batch_t::span_t> batch_t::spans(const span_t &from) const {
+      std::vector<span_t> result;
+      for (int i = from.vao; i < (int)vaos.size(); ++i) {
+         int vertex = i == from.vao ? from.vertex : 0;
+         int index = i == from.vao ? from.index : 0;
+         int vertices = vaos[i]->vertices.size() - vertex;
+         int indices = vaos[i]->indices.size() - index;
+         if (vertices || indices) {
+            result.push_back( { i, vertex, vertices, index, indices } );
+         }
+      }
+      return result;
+   }
+
+   bool batch_t::patch(const std::vector<span_t> &spans, const batch_t &source) {
+      DEBUG_METHOD();
+      if (spans.empty() || source.vaos.empty()) {
+         return spans.empty() && source.vaos.empty();
+      }
+      // Only handle the common case of the geometry landing in a single VAO
+      // on both sides. Anything else the caller should rebuild from scratch.
+      if (spans.size() != 1 || source.vaos.size() != 1) {
+         return false;
+      }
+      const auto &span = spans[0];
+      const auto &from = *source.vaos[0];
+      auto &to = *vaos[span.vao];
+
+      if ((int)from.vertices.size() != span.vertices || (int)from.indices.size() != span.indices) {
+         return false;
+      }
+      for (int i = 0; i < span.indices; ++i) {
+         if (to.indices[span.index + i] != span.vertex + from.indices[i]) {
+            return false;
+         }
+      }
+      std::array<int,16> tunits;
+      for (size_t i = 0; i < from.textures.size(); ++i) {
+         tunits[i] = to.hasTexture(from.textures[i]);
+         if (tunits[i] == -1) {
+            return false;
+         }
+      }
+
+      for (int i = 0; i < span.vertices; ++i) {
+         const auto &v = from.vertices[i];
+         auto &w = to.vertices[span.vertex + i];
+         w.position = v.position;
+         w.normal = v.normal;
+         w.coord = v.coord;
+         w.fill = v.fill;
+         w.tunit = v.tunit == -1 ? -1 : tunits[v.tunit];
+         to.materials[span.vertex + i] = from.materials[i];
+      }
+      to.patch(span.vertex, span.vertex + span.vertices);
+      return true;
+   }
+
+   void batch_t::transform(const glm::mat4 &transform) {
+      if (vaos.empty() || vaos.back()->transforms.size() == MaxTransformsPerBatch) {
+         vaos.emplace_back(newVAO());
+      }
+      vaos.back()->transforms.push_back(transform);
+   }
+
+   void batch_t::transform(const std::vector<span_t> &spans, const glm::mat4 &transform) {
+      for (const auto &span : spans) {
+         if (span.vertices) {
+            int slot = vaos[span.vao]->vertices[span.vertex].mindex;
+            palette_patches.emplace_back( span.vao, slot, transform );
+         }
+      }
+   }
+
+   void batch_t::rewind() {
+      if (!vaos.empty()) {
+         spare = vaos.front();
+         spare->vertices.clear();
+         spare->materials.clear();
+         spare->indices.clear();
+         spare->textures.clear();
+         spare->transforms.clear();
+         vaos.clear();
+      }
+   }
+
+   // Merge vertices that are identical in every attribute, then reorder
+   // triangles and vertices for the GPU's caches. Triangle order changes so
+   // this isn't for geometry relying on draw order for blending.
+   void VAO_t::optimize(mesh_stats_t &stats) {
+      int triangles = indices.size() / 3;
+      stats.vertices_before += vertices.size();
+      stats.triangles += triangles;
+      stats.acmr_before += acmr(indices) * triangles;
+
+      auto bytes = [&](int i) {
+         return std::pair{ std::string_view( (const char*)&vertices[i], sizeof(vertex_t) ),
+                           std::string_view( (const char*)&materials[i], sizeof(material_t) ) };
+      };
+      auto hash = [&](int i) {
+         auto [v, m] = bytes(i);
+         return std::hash<std::string_view>{}(v) * 31 ^ std::hash<std::string_view>{}(m);
+      };
+      auto equal = [&](int a, int b) {
+         return bytes(a) == bytes(b);
+      };
+      std::unordered_map<int, int, decltype(hash), decltype(equal)> first(vertices.size(), hash, equal);
+      std::vector<int> weld(vertices.size());
+      for (int i = 0; i < (int)vertices.size(); ++i) {
+         weld[i] = first.try_emplace(i, i).first->second;
+      }
+      for (auto &i : indices) {
+         i = weld[i];
+      }
+
+      optimizeVertexCache( indices, vertices.size() );
+      auto order = optimizeVertexFetch( indices, vertices.size() );
+      std::vector<vertex_t> new_vertices;
+      std::vector<material_t> new_materials;
+      new_vertices.reserve( order.size() );
+      new_materials.reserve( order.size() );
+      for (int i : order) {
+         new_vertices.push_back( vertices[i] );
+         new_materials.push_back( materials[i] );
+      }
+      vertices = std::move(new_vertices);
+      materials = std::move(new_materials);
+
+      stats.vertices_after += vertices.size();
+      stats.acmr_after += acmr(indices) * triangles;
+   }
+
+   batch_t_ptr batch_t::extractTranslucent(const glm::mat4 &view) {
+      struct triangle_t {
+         int vao;
+         unsigned short a, b, c;
+      };
+      std::vector<triangle_t> triangles;
+      std::vector<float> depths;
+
+      for (int v = 0; v < (int)vaos.size(); ++v) {
+         auto &vao = *vaos[v];
+         std::vector<glm::mat4> model_view;
+         for (const auto &t : vao.transforms) {
+            model_view.push_back( view * t );
+         }
+         size_t kept = 0;
+         for (size_t i = 0; i + 2 < vao.indices.size(); i += 3) {
+            unsigned short a = vao.indices[i], b = vao.indices[i + 1], c = vao.indices[i + 2];
+            const auto &va = vao.vertices[a];
+            const auto &vb = vao.vertices[b];
+            const auto &vc = vao.vertices[c];
+            if (va.fill.a < 1.0F || vb.fill.a < 1.0F || vc.fill.a < 1.0F) {
+               glm::vec3 centroid = (va.position + vb.position + vc.position) / 3.0F;
+               depths.push_back( (model_view[va.mindex] * glm::vec4( centroid, 1.0F )).z );
+               triangles.push_back( { v, a, b, c } );
+            } else {
+               vao.indices[kept++] = a;
+               vao.indices[kept++] = b;
+               vao.indices[kept++] = c;
+            }
+         }
+         vao.indices.resize( kept );
+      }
+
+      if (triangles.empty()) {
+         return {};
+      }
+
+      // Transforms are baked into the sorted vertices as triangles from
+      // different palette entries end up interleaved.
+      auto sorted = std::make_shared<batch_t>();
+      sorted->uses_textures = uses_textures;
+      sorted->uses_circles = uses_circles;
+      std::vector<std::vector<glm::mat3>> normal_matrices;
+      for (auto &vao : vaos) {
+         auto &normals = normal_matrices.emplace_back();
+         for (const auto &t : vao->transforms) {
+            normals.emplace_back( normalMatrix( t ) );
+         }
+      }
+
+      VAO_t *out = nullptr;
+      for (auto i : depthOrder( depths )) {
+         const auto &tri = triangles[i];
+         const auto &src = *vaos[tri.vao];
+         int src_unit = src.vertices[tri.a].tunit;
+         int tunit = -1;
+         if (src_unit >= 0) {
+            tunit = out ? out->hasTexture( src.textures[src_unit] ) : -1;
+         }
+         if (!out || out->vertices.size() + 3 > 65536 ||
+             (src_unit >= 0 && tunit < 0 && out->textures.size() == MaxTextureImageUnits)) {
+            sorted->vaos.emplace_back( sorted->newVAO() );
+            out = sorted->vaos.back().get();
+            out->transforms.push_back( glm::identity<glm::mat4>() );
+            tunit = -1;
+         }
+         if (src_unit >= 0 && tunit < 0) {
+            out->textures.push_back( src.textures[src_unit] );
+            tunit = out->textures.size() - 1;
+         }
+         for (auto index : { tri.a, tri.b, tri.c }) {
+            vertex_t v = src.vertices[index];
+            v.position = glm::vec3( src.transforms[v.mindex] * glm::vec4( v.position, 1.0F ) );
+            v.normal = normal_matrices[tri.vao][v.mindex] * v.normal;
+            v.tunit = tunit;
+            v.mindex = 0;
+            out->indices.push_back( out->vertices.size() );
+            out->vertices.push_back( v );
+            out->materials.push_back( src.materials[index] );
+         }
+      }
+      return sorted;
+   }
+
+   mesh_stats_t batch_t::optimize() {
+      mesh_stats_t stats;
+      for (auto &vao : vaos) {
+         vao->optimize(stats);
+      }
+      if (stats.triangles) {
+         stats.acmr_before /= stats.triangles;
+         stats.acmr_after /= stats.triangles;
+      }
+      return stats;
+   }
+
+   VAO_t_ptr batch_t::newVAO() {
+      if (spare) {
+         return std::exchange(spare, nullptr);
+      }
+      return std::make_shared<VAO_t>();
+   }
+
+   // Nothing waits for the upload, it's queued ahead of the batch's next
+   // draw on the render thread.
+   void batch_t::loadPatches() {
+      std::vector<std::pair<VAO_t_ptr, VAO_t::upload_t>> uploads;
+      for (auto &vao : vaos) {
+         if (auto upload = vao->takePatch()) {
+            uploads.emplace_back( vao, std::move( *upload ) );
+         }
+      }
+      // Only the root moved, say.
+      if (uploads.empty() && palette_patches.empty()) {
+         return;
+      }
+      // Palette changes are applied on the render thread so they can't race
+      // with a previous draw of the batch.
+      renderThread.enqueue( [vaos = vaos, palette = std::move( palette_patches ), uploads = std::move( uploads )] {
+         for (const auto &p : palette) {
+            vaos[p.vao]->transforms[p.slot] = p.transform;
+         }
+         for (const auto &[vao, upload] : uploads) {
+            vao->loadPatch( upload );
+         }
+      } );
+      palette_patches.clear();
+   }
+
    bool batch_t::usesCircles() const {
       return uses_circles;
    }
@@ -524,6 +860,164 @@ namespace gl {
       vaos.clear();
    }
 
+   // Everything is written as 32 bit words in native byte order, the file
+   // header is responsible for rejecting data from a different platform.
+   template <typename T>
+   static void writeArray(std::ostream &out, const T *data, size_t count) {
+      out.write( (const char *)data, count * sizeof(T) );
+      size_t padding = (4 - (count * sizeof(T)) % 4) % 4;
+      out.write( "\0\0\0", padding );
+   }
+
+   template <typename T>
+   static size_t arraySize(size_t count) {
+      return (count * sizeof(T) + 3) / 4 * 4;
+   }
+
+   template <typename T>
+   static bool readArray(std::string_view &data, T *out, size_t count) {
+      size_t bytes = count * sizeof(T);
+      size_t padded = arraySize<T>(count);
+      if (data.size() < padded) {
+         return false;
+      }
+      std::memcpy( (void *)out, data.data(), bytes );
+      data.remove_prefix( padded );
+      return true;
+   }
+
+   static constexpr int32_t BlankTexture = -1;
+   static constexpr int32_t CircleTexture = -2;
+   static constexpr int32_t MaxTextureSize = 16384;
+
+   void batch_t::write(std::ostream &out) const {
+      std::vector<texture_t_ptr> textures;
+      std::unordered_map<texture_t_ptr, int32_t> texture_index;
+      for (auto &vao : vaos) {
+         for (auto &t : vao->textures) {
+            if (t != texture_t::blank() && t != texture_t::circle() && !texture_index.contains(t)) {
+               texture_index[t] = textures.size();
+               textures.push_back(t);
+            }
+         }
+      }
+
+      uint32_t count = textures.size();
+      writeArray( out, &count, 1 );
+      std::vector<unsigned int> pixels;
+      for (auto &t : textures) {
+         int32_t info[3] = { t->get_width(), t->get_height(), t->get_wrap() };
+         writeArray( out, info, 3 );
+         pixels.resize( info[0] * info[1] );
+         t->get_pixels( pixels.data() );
+         writeArray( out, pixels.data(), pixels.size() );
+      }
+
+      count = vaos.size();
+      writeArray( out, &count, 1 );
+      for (auto &vao : vaos) {
+         uint32_t sizes[4] = { (uint32_t)vao->vertices.size(), (uint32_t)vao->indices.size(),
+                               (uint32_t)vao->textures.size(), (uint32_t)vao->transforms.size() };
+         writeArray( out, sizes, 4 );
+         writeArray( out, vao->vertices.data(), vao->vertices.size() );
+         writeArray( out, vao->materials.data(), vao->materials.size() );
+         writeArray( out, vao->indices.data(), vao->indices.size() );
+         for (auto &t : vao->textures) {
+            int32_t i = t == texture_t::blank() ? BlankTexture :
+               t == texture_t::circle() ? CircleTexture : texture_index[t];
+            writeArray( out, &i, 1 );
+         }
+         writeArray( out, vao->transforms.data(), vao->transforms.size() );
+      }
+   }
+
+   bool batch_t::read(std::string_view data) {
+      vaos.clear();
+      uses_textures = false;
+      uses_circles = false;
+
+      uint32_t count;
+      if (!readArray( data, &count, 1 )) {
+         return false;
+      }
+      std::vector<texture_t_ptr> textures;
+      std::vector<unsigned int> pixels;
+      for (uint32_t i = 0; i < count; ++i) {
+         int32_t info[3];
+         if (!readArray( data, info, 3 ) || info[0] < 0 || info[1] < 0 ||
+             info[0] > MaxTextureSize || info[1] > MaxTextureSize) {
+            return false;
+         }
+         // Check the data is there before allocating room for it.
+         size_t size = (size_t)info[0] * (size_t)info[1];
+         if (data.size() < arraySize<unsigned int>( size )) {
+            return false;
+         }
+         pixels.resize( size );
+         if (!readArray( data, pixels.data(), pixels.size() )) {
+            return false;
+         }
+         auto t = std::make_shared<texture_t>();
+         t->set_pixels( pixels.data(), info[0], info[1], info[2] );
+         textures.push_back( t );
+      }
+
+      if (!readArray( data, &count, 1 )) {
+         return false;
+      }
+      for (uint32_t i = 0; i < count; ++i) {
+         uint32_t sizes[4];
+         if (!readArray( data, sizes, 4 ) || sizes[0] > 65536 ||
+             sizes[2] > MaxTextureImageUnits || sizes[3] > MaxTransformsPerBatch) {
+            return false;
+         }
+         if (data.size() < arraySize<vertex_t>( sizes[0] ) + arraySize<material_t>( sizes[0] ) +
+             arraySize<unsigned short>( sizes[1] )) {
+            return false;
+         }
+         auto vao = newVAO();
+         vao->vertices.resize( sizes[0] );
+         vao->materials.resize( sizes[0] );
+         vao->indices.resize( sizes[1] );
+         vao->transforms.resize( sizes[3] );
+         if (!readArray( data, vao->vertices.data(), sizes[0] ) ||
+             !readArray( data, vao->materials.data(), sizes[0] ) ||
+             !readArray( data, vao->indices.data(), sizes[1] )) {
+            return false;
+         }
+         for (auto index : vao->indices) {
+            if (index >= sizes[0]) {
+               return false;
+            }
+         }
+         for (const auto &v : vao->vertices) {
+            if (v.tunit < -1 || v.tunit >= (int)sizes[2] || v.mindex < 0 || v.mindex >= (int)sizes[3]) {
+               return false;
+            }
+         }
+         for (uint32_t j = 0; j < sizes[2]; ++j) {
+            int32_t t;
+            if (!readArray( data, &t, 1 ) || t < CircleTexture || t >= (int32_t)textures.size()) {
+               return false;
+            }
+            if (t == BlankTexture) {
+               vao->textures.push_back( texture_t::blank() );
+            } else if (t == CircleTexture) {
+               vao->textures.push_back( texture_t::circle() );
+               uses_circles = true;
+            } else {
+               vao->textures.push_back( textures[t] );
+               uses_textures = true;
+            }
+         }
+         if (!readArray( data, vao->transforms.data(), sizes[3] )) {
+            return false;
+         }
+         vaos.push_back( vao );
+      }
+      return data.empty();
+   }
+
    void shader_t::bind() const {
       glUseProgram(programID);
    }
@@ -535,12 +1029,16 @@ namespace gl {
       indices.reserve(65536);
       textures.reserve(16);
       transforms.reserve(16);
-      renderThread.enqueue( [&] {
-         // glGenVertexArrays(1, &vao);
+   }
+
+   // Buffers are created on first use from the render thread so a batch
+   // that is only ever used as a scratch area never touches GL.
+   void VAO_t::genBuffers() {
+      if (!indexId) {
          glGenBuffers(1, &indexId);
          glGenBuffers(1, &vertexId);
          glGenBuffers(1, &materialId);
-      } );
+      }
    }
    
    VAO_t::VAO_t(const VAO_t &that) noexcept {
@@ -567,6 +1065,8 @@ namespace gl {
       std::swap(materials, other.materials);
       std::swap(textures, other.textures);
       std::swap(transforms, other.transforms);
+      std::swap(patch_begin, other.patch_begin);
+      std::swap(patch_end, other.patch_end);
       return *this;
    }
 
@@ -574,6 +1074,7 @@ namespace gl {
       DEBUG_METHOD();
       if (!vao)
          glGenVertexArrays(1, &vao);
+      genBuffers();
       glBindVertexArray(vao);
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexId);
       glBindBuffer(GL_ARRAY_BUFFER, vertexId);
@@ -607,11 +1108,46 @@ namespace gl {
       glBufferData(target, data.size() * sizeof(T), data.data(), usage);
    }
 
-   void VAO_t::loadBuffers() const {
+   template <typename T>
+   static void loadBufferSubData(GLenum target, GLint bufferId, const std::vector<T> &data, int offset) {
+      glBindBuffer(target, bufferId);
+      glBufferSubData(target, offset * sizeof(T), data.size() * sizeof(T), data.data());
+   }
+
+   void VAO_t::loadBuffers() {
       DEBUG_METHOD();
+      genBuffers();
       loadBufferData(GL_ARRAY_BUFFER, vertexId, vertices, GL_STREAM_DRAW);
       loadBufferData(GL_ARRAY_BUFFER, materialId, materials, GL_STREAM_DRAW);
       loadBufferData(GL_ELEMENT_ARRAY_BUFFER, indexId, indices, GL_STREAM_DRAW);
+      patch_begin = patch_end = 0;
+   }
+
+   void VAO_t::patch(int begin, int end) {
+      if (patch_begin == patch_end) {
+         patch_begin = begin;
+         patch_end = end;
+      } else {
+         patch_begin = std::min(patch_begin, begin);
+         patch_end = std::max(patch_end, end);
+      }
+   }
+
+   std::optional<VAO_t::upload_t> VAO_t::takePatch() {
+      if (patch_begin == patch_end) {
+         return std::nullopt;
+      }
+      upload_t upload{ patch_begin,
+         { vertices.begin() + patch_begin, vertices.begin() + patch_end },
+         { materials.begin() + patch_begin, materials.begin() + patch_end } };
+      patch_begin = patch_end = 0;
+      return upload;
+   }
+
+   void VAO_t::loadPatch(const upload_t &upload) {
+      DEBUG_METHOD();
+      loadBufferSubData(GL_ARRAY_BUFFER, vertexId, upload.vertices, upload.begin);
+      loadBufferSubData(GL_ARRAY_BUFFER, materialId, upload.materials, upload.begin);
    }
 
    void VAO_t::draw() const {
@@ -0,0 +1,247 @@
+#include "processing_opengl_mesh.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <numeric>
+#include <thread>
+
+namespace gl {
+
+   float acmr(const std::vector<unsigned short> &indices, int cache_size) {
+      int triangles = indices.size() / 3;
+      if (triangles == 0) {
+         return 0.0F;
+      }
+      int vertex_count = *std::max_element(indices.begin(), indices.end()) + 1;
+      // A vertex is in the FIFO if fewer than cache_size misses happened
+      // since it was last loaded.
+      std::vector<int> loaded(vertex_count, -1);
+      int misses = 0;
+      for (auto i : indices) {
+         if (loaded[i] < 0 || misses - loaded[i] >= cache_size) {
+            loaded[i] = misses++;
+         }
+      }
+      return (float)misses / triangles;
+   }
+
+   namespace {
+      constexpr int CacheSize = 32;
+      constexpr float CacheDecayPower = 1.5F;
+      constexpr float LastTriScore = 0.75F;
+      constexpr float ValenceBoostScale = 2.0F;
+      constexpr float ValenceBoostPower = 0.5F;
+
+      // Vertices recently used score highly so their triangles get picked
+      // next, as do vertices with few triangles left so that they're
+      // finished off rather than left stranded.
+      float vertexScore(int cache_position, int remaining) {
+         if (remaining == 0) {
+            return -1.0F;
+         }
+         float score = 0.0F;
+         if (cache_position >= 0) {
+            if (cache_position < 3) {
+               score = LastTriScore;
+            } else {
+               score = std::pow(1.0F - float(cache_position - 3) / (CacheSize - 3), CacheDecayPower);
+            }
+         }
+         return score + ValenceBoostScale * std::pow(float(remaining), -ValenceBoostPower);
+      }
+   }
+
+   void optimizeVertexCache(std::vector<unsigned short> &indices, int vertex_count) {
+      int triangles = indices.size() / 3;
+      if (triangles == 0) {
+         return;
+      }
+
+      // Triangles using each vertex, live ones are kept at the front of
+      // each vertex's range.
+      std::vector<int> remaining(vertex_count, 0);
+      for (auto i : indices) {
+         remaining[i]++;
+      }
+      std::vector<int> offsets(vertex_count + 1, 0);
+      std::partial_sum(remaining.begin(), remaining.end(), offsets.begin() + 1);
+      std::vector<int> adjacency(indices.size());
+      std::fill(remaining.begin(), remaining.end(), 0);
+      for (int t = 0; t < triangles; ++t) {
+         for (int k = 0; k < 3; ++k) {
+            int v = indices[t * 3 + k];
+            adjacency[offsets[v] + remaining[v]++] = t;
+         }
+      }
+
+      std::vector<int> cache_position(vertex_count, -1);
+      std::vector<float> vertex_score(vertex_count);
+      for (int v = 0; v < vertex_count; ++v) {
+         vertex_score[v] = vertexScore(-1, remaining[v]);
+      }
+      auto triangleScore = [&](int t) {
+         return vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+      };
+      std::vector<float> triangle_score(triangles);
+      for (int t = 0; t < triangles; ++t) {
+         triangle_score[t] = triangleScore(t);
+      }
+      std::vector<bool> emitted(triangles, false);
+
+      std::vector<unsigned short> result;
+      result.reserve(indices.size());
+      std::vector<int> cache, next_cache;
+      int best = std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin();
+      int cursor = 0;
+
+      while (true) {
+         if (best < 0) {
+            // Nothing in the cache has triangles left, start somewhere new.
+            while (cursor < triangles && emitted[cursor]) {
+               ++cursor;
+            }
+            if (cursor == triangles) {
+               break;
+            }
+            best = cursor;
+         }
+         emitted[best] = true;
+
+         next_cache.clear();
+         for (int k = 0; k < 3; ++k) {
+            int v = indices[best * 3 + k];
+            result.push_back(v);
+            auto begin = adjacency.begin() + offsets[v];
+            auto end = begin + remaining[v];
+            std::iter_swap(std::find(begin, end, best), end - 1);
+            --remaining[v];
+            if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end()) {
+               next_cache.push_back(v);
+            }
+         }
+         int used = next_cache.size();
+         for (int v : cache) {
+            if (std::find(next_cache.begin(), next_cache.begin() + used, v) == next_cache.begin() + used) {
+               next_cache.push_back(v);
+            }
+         }
+
+         // Rescore everything that moved in the cache, including the
+         // vertices just pushed out of it, and pick the best triangle they
+         // touch to emit next.
+         for (int i = 0; i < (int)next_cache.size(); ++i) {
+            int v = next_cache[i];
+            cache_position[v] = i < CacheSize ? i : -1;
+            vertex_score[v] = vertexScore(cache_position[v], remaining[v]);
+         }
+         best = -1;
+         float best_score = -1.0F;
+         for (int v : next_cache) {
+            for (int j = offsets[v]; j < offsets[v] + remaining[v]; ++j) {
+               int t = adjacency[j];
+               triangle_score[t] = triangleScore(t);
+               if (triangle_score[t] > best_score) {
+                  best_score = triangle_score[t];
+                  best = t;
+               }
+            }
+         }
+
+         if (next_cache.size() > CacheSize) {
+            next_cache.resize(CacheSize);
+         }
+         std::swap(cache, next_cache);
+      }
+
+      indices = std::move(result);
+   }
+
+   std::vector<int> optimizeVertexFetch(std::vector<unsigned short> &indices, int vertex_count) {
+      std::vector<int> remap(vertex_count, -1);
+      std::vector<int> order;
+      order.reserve(vertex_count);
+      for (auto &i : indices) {
+         if (remap[i] < 0) {
+            remap[i] = order.size();
+            order.push_back(i);
+         }
+         i = remap[i];
+      }
+      return order;
+   }
+
+   std::vector<uint32_t> depthOrder(const std::vector<float> &depths) {
+      constexpr size_t ParallelThreshold = 1 << 14;
+      size_t n = depths.size();
+
+      // Flip the bits of IEEE floats so they compare correctly as unsigned.
+      std::vector<uint32_t> keys(n), next_keys(n), order(n), next_order(n);
+      for (size_t i = 0; i < n; ++i) {
+         uint32_t u;
+         std::memcpy( &u, &depths[i], sizeof(u) );
+         keys[i] = (u & 0x80000000U) ? ~u : (u | 0x80000000U);
+         order[i] = i;
+      }
+
+      int threads = n < ParallelThreshold ? 1 : std::clamp( (int)std::thread::hardware_concurrency(), 1, 16 );
+      size_t chunk = (n + threads - 1) / threads;
+      auto inParallel = [&](auto &&f) {
+         if (threads == 1) {
+            f(0);
+            return;
+         }
+         std::vector<std::future<void>> jobs;
+         for (int t = 0; t < threads; ++t) {
+            jobs.push_back( std::async( std::launch::async, f, t ) );
+         }
+         for (auto &job : jobs) {
+            job.get();
+         }
+      };
+
+      std::vector<std::array<uint32_t,256>> counts(threads);
+      for (int shift = 0; shift < 32; shift += 8) {
+         inParallel( [&](int t) {
+            auto &count = counts[t];
+            count.fill(0);
+            for (size_t i = t * chunk; i < std::min( n, (t + 1) * chunk ); ++i) {
+               count[(keys[i] >> shift) & 0xFF]++;
+            }
+         } );
+
+         // Offsets go digit by digit then thread by thread so that every
+         // thread scatters into its own slots and the sort stays stable.
+         uint32_t sum = 0;
+         bool skip = false;
+         for (int d = 0; d < 256; ++d) {
+            uint32_t start = sum;
+            for (int t = 0; t < threads; ++t) {
+               uint32_t c = counts[t][d];
+               counts[t][d] = sum;
+               sum += c;
+            }
+            skip = skip || sum - start == n;
+         }
+         // Every key has the same digit, nothing would move.
+         if (skip) {
+            continue;
+         }
+
+         inParallel( [&](int t) {
+            auto &offset = counts[t];
+            for (size_t i = t * chunk; i < std::min( n, (t + 1) * chunk ); ++i) {
+               uint32_t pos = offset[(keys[i] >> shift) & 0xFF]++;
+               next_keys[pos] = keys[i];
+               next_order[pos] = order[i];
+            }
+         } );
+         std::swap( keys, next_keys );
+         std::swap( order, next_order );
+      }
+      return order;
+   }
+
+} // namespace gl
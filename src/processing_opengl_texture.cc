@@ -98,6 +98,11 @@ namespace gl {
       return id;
    }
 
+   GLint texture_t::get_wrap() const {
+      DEBUG_METHOD();
+      return wrap;
+   }
+
    void texture_t::bind() const {
       DEBUG_METHOD();
      // renderThread.enqueue( [id=id] {
@@ -1,45 +1,119 @@
 #include "processing_pfont.h"
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_MODULE_H
+#include "processing_mapped_file.h"
 #include "processing_math.h"
 #include "processing_pimage.h"
+#include "processing_profile.h"
+#include "processing_registry.h"
+#include "processing_unicode.h"
 
+#include <array>
+#include <charconv>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <list>
 #include <map>
 #include <optional>
+#include <set>
 #include <fmt/core.h>
 
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 static FT_Library ft;
 
-static PShape buildPShapeFromFace(FT_Face face, char c);
+static PShape buildPShapeFromFace(FT_Face face, char32_t c, float tolerance);
+
+// Glyphs are rasterized once and packed onto atlas pages so any amount
+// of text can be drawn from a few textures.
+struct glyph_atlas_t {
+   struct glyph_t {
+      int page = -1; // -1 if the glyph has no pixels, e.g. a space
+      int x = 0;
+      int y = 0;
+      int left = 0;
+      int top = 0;
+      int width = 0;
+      int height = 0;
+   };
+   static constexpr int PageSize = 512;
+   codepoint_table_t<glyph_t> glyphs;
+   std::vector<PImage> pages;
+   int shelf_x = 0;
+   int shelf_y = 0;
+   int shelf_height = 0;
+
+   const glyph_t *find(char32_t c) const {
+      return glyphs.find( c );
+   }
+
+   const glyph_t &add(char32_t c, FT_GlyphSlot slot);
+   const glyph_t &add(char32_t c, glyph_t glyph, const unsigned char *buffer, int pitch);
+   void place(glyph_t &glyph);
+};
+
+// Signed distance fields rendered from a face at one reference size. The
+// atlas is shared by every size of the font and the text shader keeps
+// the edges sharp however far it's scaled.
+struct sdf_atlas_t {
+   FT_Face face = nullptr;
+   std::shared_ptr<mapped_file_t> file;
+   glyph_atlas_t atlas;
+
+   sdf_atlas_t(std::shared_ptr<mapped_file_t> file_);
+
+   ~sdf_atlas_t() {
+      release();
+   }
+
+   void release() {
+      if (face) {
+         FT_Done_Face(face);
+         face = nullptr;
+      }
+   }
+
+   const glyph_atlas_t::glyph_t &glyph(char32_t c);
+};
 
-class PFontImpl {
+class PFontImpl : public registered_t<PFontImpl> {
 
 public:
    const char *name;
    int size;
    FT_Face face;
+   // Keeps the font file mapped for as long as the face uses it.
+   std::shared_ptr<mapped_file_t> file;
 
-   std::map<char,PShape> glyphs;
-   std::map<char,float> m_advance;
+   codepoint_table_t<PShape> glyphs;
+   codepoint_table_t<float> m_advance;
 
-   PShape &glyph( char x ) {
-      if (glyphs.find(x) == glyphs.end()) {
-         glyphs.emplace(x, buildPShapeFromFace( face, x ));
-         m_advance[x] = face->glyph->advance.x;
+   PShape &glyph( char32_t x ) {
+      if (auto existing = glyphs.find(x)) {
+         return *existing;
       }
-      return glyphs.find(x)->second;
+      // Glyphs are drawn scaled down from font units to the font size,
+      // so the flattening tolerance scales up by the same amount.
+      auto &shape = glyphs.insert(x, buildPShapeFromFace( face, x, CURVE_TOLERANCE * em_size() / size ));
+      m_advance.insert(x, face->glyph->advance.x);
+      return shape;
    }
 
    int em_size() const {
       return face->units_per_EM;
    }
 
-   float advance(char x) const {
-      return m_advance.at(x);
+   float advance(char32_t x) const {
+      return *m_advance.find(x);
    }
 
-   PVector getKerning(char prev, char next) const {
+   PVector getKerning(char32_t prev, char32_t next) const {
       FT_Vector kerning;
       FT_Get_Kerning( face,
                       FT_Get_Char_Index(face,prev),
@@ -48,7 +122,83 @@ public:
       return { (float)kerning.x, (float)kerning.y };
    }
 
-   std::unordered_map<std::string, PImage> words;
+   // Advances and kerning at the font's pixel size in 26.6 fixed point,
+   // loaded without rendering so text can be measured cheaply.
+   codepoint_table_t<FT_Pos> pixel_advances;
+   std::unordered_map<uint64_t, FT_Pos> kerning_pairs;
+
+   FT_Pos pixelAdvance(char32_t c) {
+      if (auto advance = pixel_advances.find(c)) {
+         return *advance;
+      }
+      FT_Load_Char(face, c, FT_LOAD_DEFAULT);
+      return pixel_advances.insert(c, face->glyph->advance.x);
+   }
+
+   FT_Pos kerning(char32_t prev, char32_t next) {
+      if (!FT_HAS_KERNING(face)) {
+         return 0;
+      }
+      auto [i, inserted] = kerning_pairs.try_emplace( (uint64_t)prev << 32 | next, 0 );
+      if (inserted) {
+         i->second = getKerning( prev, next ).x;
+      }
+      return i->second;
+   }
+
+   // Strings rendered by render_as_pimage, most recently used first. The
+   // index keys view the strings held in the list.
+   struct word_t {
+      std::string text;
+      PImage image;
+      size_t bytes;
+   };
+   std::list<word_t> words;
+   std::unordered_map<std::string_view, std::list<word_t>::iterator> word_index;
+   PFont::cache_stats_t word_stats;
+   static inline size_t word_cache_budget = 16 * 1024 * 1024;
+
+   void cacheWord(std::string text, PImage image);
+   void trimWords();
+
+   void prerasterize(std::string_view charset);
+
+   // Boxed paragraphs, most recently drawn first, keyed by their text, box
+   // and alignment. Keys view the strings held in the list.
+   struct paragraph_key_t {
+      std::string_view text;
+      float width;
+      float height;
+      int align_x;
+      int align_y;
+      bool sdf;
+      bool operator==(const paragraph_key_t &) const = default;
+   };
+   struct paragraph_key_hash_t {
+      size_t operator()(const paragraph_key_t &key) const {
+         size_t seed = std::hash<std::string_view>{}( key.text );
+         hash_combine( seed, key.width );
+         hash_combine( seed, key.height );
+         hash_combine( seed, key.align_x );
+         hash_combine( seed, key.align_y );
+         hash_combine( seed, key.sdf );
+         return seed;
+      }
+   };
+   struct paragraph_t {
+      std::string text;
+      paragraph_key_t key;
+      std::vector<PFont::glyph_quad_t> quads = {};
+   };
+   static constexpr size_t MaxCachedParagraphs = 256;
+   std::list<paragraph_t> paragraphs;
+   std::unordered_map<paragraph_key_t, std::list<paragraph_t>::iterator, paragraph_key_hash_t> paragraph_index;
+
+   glyph_atlas_t atlas;
+   std::shared_ptr<sdf_atlas_t> sdf;
+
+   const glyph_atlas_t::glyph_t &atlasGlyph(char32_t c);
+   const glyph_atlas_t::glyph_t &sdfGlyph(char32_t c);
 
    PFontImpl() : name(nullptr), size(0) {}
 
@@ -62,11 +212,18 @@ public:
    void releaseFace() {
       name = nullptr;
       size = 0;
+      sdf = {};
       FT_Done_Face(face);
    }
 
    PShape render_as_pshape(std::string_view text);
    PImage render_as_pimage(std::string_view text);
+   std::vector<PFont::glyph_quad_t> layout(std::string_view text, bool use_sdf);
+   const std::vector<PFont::glyph_quad_t> &paragraph(std::string_view text, float width, float height,
+                                                     int align_x, int align_y, bool use_sdf);
+   void layoutLine(std::vector<PFont::glyph_quad_t> &quads, std::string_view line, FT_Pos x, FT_Pos y, bool use_sdf);
+   FT_Pos lineAdvance(std::string_view line);
+   std::vector<std::string_view> wrap(std::string_view text, FT_Pos width);
 
    float textAscent() const;
    float textDescent() const;
@@ -74,24 +231,41 @@ public:
 };
 
 
+// Font names resolved so far and the files they were found in.
 static std::map<std::string, std::string> fontFileMap;
 
-static void bezierVertexQuadratic(PVector control, PVector anchor2, std::vector<PVector> &out) {
+// Font files are mapped once and shared by the faces of every size.
+static std::map<std::string, std::shared_ptr<mapped_file_t>> fontFiles;
+
+// Recently used sized fonts, most recent first, so textSize() can switch
+// back and forth without reopening the face or losing its glyph caches.
+static constexpr size_t MaxCachedFonts = 32;
+using font_key_t = std::pair<std::string, int>;
+static std::list<std::pair<font_key_t, std::shared_ptr<PFontImpl>>> fontCache;
+static std::map<font_key_t, decltype(fontCache)::iterator> fontCacheIndex;
+
+// One distance field atlas per font file whatever the size, keyed by the
+// resolved path so every name for the same file shares it.
+static std::map<std::string, std::shared_ptr<sdf_atlas_t>> sdfAtlases;
+
+static void bezierVertexQuadratic(PVector control, PVector anchor2, float tolerance, std::vector<PVector> &out) {
    float anchor1_x = out.back().x;
    float anchor1_y = out.back().y;
-   for (float t = 0.01; t <= 1; t += 0.01) {
+   int segments = bezierSegmentsQuadratic( out.back(), control, anchor2, tolerance );
+   for (int i = 1; i <= segments; ++i) {
       // Compute the Bezier curve points
+      float t = (float)i / segments;
       float x = bezierPointQuadratic( anchor1_x, control.x, anchor2.x, t );
       float y = bezierPointQuadratic( anchor1_y, control.y, anchor2.y, t );
       out.emplace_back( x, y );
    }
 }
 
-static PShape buildPShapeFromFace(FT_Face face, char c) {
+static PShape buildPShapeFromFace(FT_Face face, char32_t c, float tolerance) {
    // Load and unpack FT glyph outline data
    if (FT_Load_Char(face, c, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING | FT_LOAD_NO_SCALE))
    {
-      fmt::print("Failed to load glyph for character: {}\n",c);
+      fmt::print("Failed to load glyph for character: U+{:04X}\n", (unsigned int)c);
       abort();
    }
    FT_Outline outline = face->glyph->outline;
@@ -114,18 +288,18 @@ static PShape buildPShapeFromFace(FT_Face face, char c) {
          if (anchor && !prev_control) {
             contour.push_back(pos);
          } else if (anchor && prev_control) {
-            bezierVertexQuadratic( prev_control.value(), pos, contour);
+            bezierVertexQuadratic( prev_control.value(), pos, tolerance, contour);
             prev_control.reset();
          } else if (!anchor && !prev_control) {
             prev_control = pos;
          } else { // if (!anchor && prev_control)
             PVector anchor = ( pos + prev_control.value() ) / 2;
-            bezierVertexQuadratic( prev_control.value(), anchor, contour);
+            bezierVertexQuadratic( prev_control.value(), anchor, tolerance, contour);
             prev_control = pos;
          }
       }
       if (prev_control) {
-         bezierVertexQuadratic( prev_control.value(), contour[0], contour );
+         bezierVertexQuadratic( prev_control.value(), contour[0], tolerance, contour );
       }
 
       glyph_shape.beginContour();
@@ -139,42 +313,384 @@ static PShape buildPShapeFromFace(FT_Face face, char c) {
 }
 
 
-static void search_directory(const std::string& path, const std::string& suffix) {
-   for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
-      if (!entry.is_directory() && entry.path().extension() == suffix) {
-         fontFileMap[entry.path().filename().string()] = entry.path().string();
-      }
+#ifdef _WIN32
+static const char *systemFontDirectory = "C:\\Windows\\Fonts";
+#else
+static const char *systemFontDirectory = "/usr/share/fonts/truetype";
+#endif
+static const char *fontSuffix = ".ttf";
+
+static std::optional<long long> modificationTime(const std::filesystem::path &path) {
+   std::error_code ec;
+   auto time = std::filesystem::last_write_time( path, ec );
+   if (ec) {
+      return {};
    }
+   return time.time_since_epoch().count();
 }
 
-std::vector<std::string>  PFont::list() {
+// Where the system fonts were found on earlier runs, saved between runs
+// so a sketch doesn't walk the whole font tree every launch. Directories
+// are recorded with their modification time, which changes when fonts are
+// added, removed or renamed in them, and only those that changed are
+// rescanned. Fonts are resolved one name at a time and the tree is only
+// checked when a name can't be found.
+class font_index_t {
+   struct font_t {
+      std::string name;
+      long long mtime = 0;
+      std::string family = {};
+      std::string style = {};
+   };
+   struct directory_t {
+      long long mtime = 0;
+      std::vector<std::string> subdirectories;
+      std::vector<font_t> fonts;
+   };
+   std::map<std::string, directory_t> directories;
+   bool loaded = false;
+   bool validated = false;
+   bool dirty = false;
+
+   static constexpr const char *Header = "processing_cpp font index 1";
+
+   static std::filesystem::path file() {
+#ifdef _WIN32
+      if (const char *local = getenv("LOCALAPPDATA")) {
+         return std::filesystem::path(local) / "processing_cpp" / "fonts.index";
+      }
+#else
+      if (const char *cache = getenv("XDG_CACHE_HOME")) {
+         return std::filesystem::path(cache) / "processing_cpp" / "fonts.index";
+      }
+      if (const char *home = getenv("HOME")) {
+         return std::filesystem::path(home) / ".cache" / "processing_cpp" / "fonts.index";
+      }
+#endif
+      return {};
+   }
+
+   static std::vector<std::string> split(const std::string &line) {
+      std::vector<std::string> fields;
+      size_t start = 0;
+      size_t tab;
+      while ((tab = line.find( '\t', start )) != std::string::npos) {
+         fields.push_back( line.substr( start, tab - start ) );
+         start = tab + 1;
+      }
+      fields.push_back( line.substr( start ) );
+      return fields;
+   }
+
+   static std::string field(const char *text) {
+      std::string result = text ? text : "";
+      std::replace( result.begin(), result.end(), '\t', ' ' );
+      std::replace( result.begin(), result.end(), '\n', ' ' );
+      return result;
+   }
+
+   static std::optional<long long> number(const std::string &text) {
+      long long value;
+      auto [end, ec] = std::from_chars( text.data(), text.data() + text.size(), value );
+      if (ec != std::errc() || end != text.data() + text.size()) {
+         return {};
+      }
+      return value;
+   }
+
+   static void describe(const std::filesystem::path &path, font_t &font) {
+      FT_Face face;
+      if (FT_New_Face( ft, path.string().c_str(), 0, &face ) == 0) {
+         font.family = field( face->family_name );
+         font.style = field( face->style_name );
+         FT_Done_Face( face );
+      }
+   }
+
+   void load() {
+      loaded = true;
+      auto path = file();
+      if (path.empty()) {
+         return;
+      }
+      std::ifstream in( path );
+      std::string line;
+      if (!std::getline( in, line ) || line != Header) {
+         return;
+      }
+      directory_t *directory = nullptr;
+      while (std::getline( in, line )) {
+         auto fields = split( line );
+         std::optional<long long> mtime;
+         if (fields[0] == "D" && fields.size() == 3 && (mtime = number( fields[2] ))) {
+            directory = &directories[fields[1]];
+            directory->mtime = *mtime;
+         } else if (fields[0] == "S" && fields.size() == 2 && directory) {
+            directory->subdirectories.push_back( fields[1] );
+         } else if (fields[0] == "F" && fields.size() == 5 && directory && (mtime = number( fields[2] ))) {
+            directory->fonts.push_back( { fields[1], *mtime, fields[3], fields[4] } );
+         } else {
+            // Anything unexpected and we start again from the font tree.
+            directories.clear();
+            return;
+         }
+      }
+   }
+
+   void save() {
+      dirty = false;
+      auto path = file();
+      if (path.empty()) {
+         return;
+      }
+      std::error_code ec;
+      std::filesystem::create_directories( path.parent_path(), ec );
+      // Written aside and renamed so sketches starting together never
+      // read half an index.
+      auto temporary = path;
 #ifdef _WIN32
-   std::string path_to_search = "C:\\Windows\\Fonts";
+      temporary += fmt::format( ".{}", _getpid() );
 #else
-   std::string path_to_search = "/usr/share/fonts/truetype";
+      temporary += fmt::format( ".{}", getpid() );
 #endif
-   std::string suffix_to_find = ".ttf";
-   search_directory(path_to_search, suffix_to_find);
-   path_to_search = "data";
-   search_directory(path_to_search, suffix_to_find);
-   std::vector<std::string> keys;
-   keys.reserve(fontFileMap.size());
-   for (auto const& [key, value] : fontFileMap) {
-      keys.push_back(key);
-   }
-   if (keys.size() == 0) {
+      {
+         std::ofstream out( temporary );
+         if (!out.is_open()) {
+            return;
+         }
+         out << Header << "\n";
+         for (const auto &[name, directory] : directories) {
+            out << "D\t" << name << "\t" << directory.mtime << "\n";
+            for (const auto &subdirectory : directory.subdirectories) {
+               out << "S\t" << subdirectory << "\n";
+            }
+            for (const auto &font : directory.fonts) {
+               out << "F\t" << font.name << "\t" << font.mtime << "\t" << font.family << "\t" << font.style << "\n";
+            }
+         }
+      }
+      std::filesystem::rename( temporary, path, ec );
+   }
+
+   directory_t scan(const std::string &path, long long mtime, const directory_t *previous) {
+      directory_t directory;
+      directory.mtime = mtime;
+      std::error_code ec;
+      for (const auto &entry : std::filesystem::directory_iterator( path, ec )) {
+         if (entry.is_directory( ec )) {
+            directory.subdirectories.push_back( entry.path().string() );
+         } else if (entry.path().extension() == fontSuffix) {
+            font_t font{ entry.path().filename().string(), modificationTime( entry.path() ).value_or( 0 ) };
+            const font_t *unchanged = nullptr;
+            if (previous) {
+               for (const auto &f : previous->fonts) {
+                  if (f.name == font.name && f.mtime == font.mtime) {
+                     unchanged = &f;
+                  }
+               }
+            }
+            if (unchanged) {
+               font = *unchanged;
+            } else {
+               describe( entry.path(), font );
+            }
+            directory.fonts.push_back( font );
+         }
+      }
+      return directory;
+   }
+
+   void validate(const std::string &path, std::map<std::string, directory_t> &valid) {
+      auto mtime = modificationTime( path );
+      if (!mtime || valid.contains( path )) {
+         return;
+      }
+      auto existing = directories.find( path );
+      directory_t directory;
+      if (existing != directories.end() && existing->second.mtime == *mtime) {
+         directory = std::move( existing->second );
+      } else {
+         directory = scan( path, *mtime, existing != directories.end() ? &existing->second : nullptr );
+         dirty = true;
+      }
+      auto subdirectories = directory.subdirectories;
+      valid.emplace( path, std::move( directory ) );
+      for (const auto &subdirectory : subdirectories) {
+         validate( subdirectory, valid );
+      }
+   }
+
+   static bool regularStyle(const std::string &style) {
+      return style == "Regular" || style == "Book" || style == "Normal";
+   }
+
+   // Matches the file name, or failing that "Family Style" or the family
+   // on its own for its regular style. Fonts that have gone are skipped
+   // so the caller revalidates.
+   std::optional<std::string> find(const std::string &name) {
+      for (bool by_family : { false, true }) {
+         for (auto &[path, directory] : directories) {
+            for (auto &font : directory.fonts) {
+               bool match = by_family ?
+                  (font.family + " " + font.style == name || (font.family == name && regularStyle( font.style ))) :
+                  font.name == name;
+               if (!match) {
+                  continue;
+               }
+               auto location = std::filesystem::path( path ) / font.name;
+               auto mtime = modificationTime( location );
+               if (!mtime) {
+                  continue;
+               }
+               if (*mtime != font.mtime) {
+                  font.mtime = *mtime;
+                  describe( location, font );
+                  dirty = true;
+               }
+               return location.string();
+            }
+         }
+      }
+      return {};
+   }
+
+public:
+   void validate() {
+      if (!loaded) {
+         load();
+      }
+      if (!validated) {
+         std::map<std::string, directory_t> valid;
+         validate( systemFontDirectory, valid );
+         if (valid.size() != directories.size()) {
+            dirty = true;
+         }
+         directories = std::move( valid );
+         validated = true;
+      }
+   }
+
+   std::optional<std::string> resolve(const std::string &name) {
+      if (!loaded) {
+         load();
+      }
+      auto found = find( name );
+      if (!found && !validated) {
+         validate();
+         found = find( name );
+      }
+      if (dirty) {
+         save();
+      }
+      return found;
+   }
+
+   std::vector<std::string> names() {
+      validate();
+      if (dirty) {
+         save();
+      }
+      std::vector<std::string> result;
+      for (const auto &[path, directory] : directories) {
+         for (const auto &font : directory.fonts) {
+            result.push_back( font.name );
+         }
+      }
+      return result;
+   }
+};
+
+static font_index_t fontIndex;
+
+// Fonts in the sketch's data folder win over system fonts.
+static std::vector<std::filesystem::path> dataFonts() {
+   std::vector<std::filesystem::path> fonts;
+   std::error_code ec;
+   if (std::filesystem::is_directory( "data", ec )) {
+      for (const auto &entry : std::filesystem::recursive_directory_iterator( "data", ec )) {
+         if (!entry.is_directory( ec ) && entry.path().extension() == fontSuffix) {
+            fonts.push_back( entry.path() );
+         }
+      }
+   }
+   return fonts;
+}
+
+static std::optional<std::string> fontPath(const std::string &name) {
+   auto known = fontFileMap.find( name );
+   if (known != fontFileMap.end()) {
+      return known->second;
+   }
+   std::optional<std::string> path;
+   std::error_code ec;
+   if (std::filesystem::is_regular_file( std::filesystem::path( "data" ) / name, ec )) {
+      path = (std::filesystem::path( "data" ) / name).string();
+   } else {
+      for (const auto &font : dataFonts()) {
+         if (font.filename() == name) {
+            path = font.string();
+         }
+      }
+   }
+   if (!path) {
+      path = fontIndex.resolve( name );
+   }
+   if (path) {
+      fontFileMap[name] = *path;
+   }
+   return path;
+}
+
+std::vector<std::string>  PFont::list() {
+   std::set<std::string> names;
+   for (auto &name : fontIndex.names()) {
+      names.insert( name );
+   }
+   for (auto &font : dataFonts()) {
+      names.insert( font.filename().string() );
+   }
+   if (names.size() == 0) {
       abort();
    };
-   return keys;
+   return { names.begin(), names.end() };
 }
 
 
+static std::shared_ptr<mapped_file_t> fontFile(const std::string &path) {
+   auto &file = fontFiles[path];
+   if (!file) {
+      file = std::make_shared<mapped_file_t>(path);
+   }
+   return file;
+}
+
+static std::shared_ptr<PFontImpl> cachedFont(const char *name, int size) {
+   font_key_t key = { name, size };
+   auto existing = fontCacheIndex.find( key );
+   if (existing != fontCacheIndex.end()) {
+      fontCache.splice( fontCache.begin(), fontCache, existing->second );
+      return existing->second->second;
+   }
+   auto font = std::make_shared<PFontImpl>(name, size);
+   fontCache.emplace_front( key, font );
+   fontCacheIndex.emplace( key, fontCache.begin() );
+   if (fontCache.size() > MaxCachedFonts) {
+      fontCacheIndex.erase( fontCache.back().first );
+      fontCache.pop_back();
+   }
+   return font;
+}
+
 PFontImpl::PFontImpl(const char *name_, int size_) : name(name_), size(size_) {
-   if (fontFileMap.size() == 0) {
-      PFont::list();
+   auto path = fontPath(name);
+   if (!path) {
+      fmt::print("Failed to load face\n");
+      fmt::print("Font not found: {},{}\n", name, size);
+      abort();
    }
-   const auto *const fontPath = fontFileMap[name].c_str();
-   if (FT_New_Face(ft, fontPath, 0, &face) != 0) {
+   file = fontFile( *path );
+   auto data = file->view();
+   if (FT_New_Memory_Face(ft, (const FT_Byte *)data.data(), data.size(), 0, &face) != 0) {
       fmt::print("Failed to load face\n");
       fmt::print("FT_New_Face failed: {},{}\n", name, size);
       abort();
@@ -197,7 +713,8 @@ PShape PFontImpl::render_as_pshape(std::string_view text) {
    group.scale( scale_factor );
    float x = 0;
    float y = 0;
-   for ( auto c : text ) {
+   for (size_t i = 0; i < text.size();) {
+      char32_t c = nextCodepoint( text, i );
       if (c == '\n') {
          x = 0;
          y += face->size->metrics.height/64.0F / ( scale_factor );
@@ -212,6 +729,371 @@ PShape PFontImpl::render_as_pshape(std::string_view text) {
    return group;
 }
 
+// Shelf packing, glyphs go left to right along a shelf as tall as the
+// tallest glyph on it. A pixel gap keeps texture filtering from bleeding
+// between neighbours.
+void glyph_atlas_t::place(glyph_t &glyph) {
+   int w = glyph.width + 1;
+   int h = glyph.height + 1;
+   if (!pages.empty() && shelf_x + w > pages.back().width) {
+      shelf_y += shelf_height;
+      shelf_x = 0;
+      shelf_height = 0;
+   }
+   if (pages.empty() || shelf_x + w > pages.back().width || shelf_y + h > pages.back().height) {
+      int page_size = std::max( { PageSize, w, h } );
+      PImage page = createImage( page_size, page_size, CLAMP );
+      std::fill( page._pixels(), page._pixels() + (page_size * page_size), 0 );
+      pages.push_back( page );
+      shelf_x = 0;
+      shelf_y = 0;
+      shelf_height = 0;
+   }
+   glyph.page = pages.size() - 1;
+   glyph.x = shelf_x;
+   glyph.y = shelf_y;
+   shelf_x += w;
+   shelf_height = std::max( shelf_height, h );
+}
+
+// Copies a rendered glyph onto a page, coverage or distance goes in the
+// alpha channel.
+const glyph_atlas_t::glyph_t &glyph_atlas_t::add(char32_t c, glyph_t glyph, const unsigned char *buffer, int pitch) {
+   if (glyph.width > 0 && glyph.height > 0) {
+      place( glyph );
+      PImage &page = pages[glyph.page];
+      for (int row = 0; row < glyph.height; row++) {
+         for (int col = 0; col < glyph.width; col++) {
+            page.set( glyph.x + col, glyph.y + row, color( 255, 255, 255, buffer[col + row * pitch] ) );
+         }
+      }
+   }
+   return glyphs.insert( c, glyph );
+}
+
+const glyph_atlas_t::glyph_t &glyph_atlas_t::add(char32_t c, FT_GlyphSlot slot) {
+   glyph_t glyph;
+   glyph.left = slot->bitmap_left;
+   glyph.top = slot->bitmap_top;
+   glyph.width = slot->bitmap.width;
+   glyph.height = slot->bitmap.rows;
+   return add( c, glyph, slot->bitmap.buffer, slot->bitmap.pitch );
+}
+
+sdf_atlas_t::sdf_atlas_t(std::shared_ptr<mapped_file_t> file_) : file(file_) {
+   auto data = file->view();
+   if (FT_New_Memory_Face(ft, (const FT_Byte *)data.data(), data.size(), 0, &face) != 0) {
+      fmt::print("Failed to load face for distance field\n");
+      abort();
+   }
+   if (FT_Set_Pixel_Sizes(face, 0, PFont::SDFReferenceSize)) {
+      fmt::print("Failed to set size\n");
+      abort();
+   }
+}
+
+const glyph_atlas_t::glyph_t &sdf_atlas_t::glyph(char32_t c) {
+   if (auto existing = atlas.find( c )) {
+      return *existing;
+   }
+   FT_Load_Char(face, c, FT_LOAD_DEFAULT);
+   FT_Render_Glyph(face->glyph, FT_RENDER_MODE_SDF);
+   return atlas.add( c, face->glyph );
+}
+
+const glyph_atlas_t::glyph_t &PFontImpl::atlasGlyph(char32_t c) {
+   if (auto existing = atlas.find( c )) {
+      return *existing;
+   }
+   FT_Load_Char(face, c, FT_LOAD_RENDER);
+   return atlas.add( c, face->glyph );
+}
+
+// FreeType faces aren't thread safe so each worker renders with a face of
+// its own, opened on the same mapped file. Opening and closing faces
+// touches the library and stays on this thread. Glyphs are packed tallest
+// first once they're all back.
+void PFontImpl::prerasterize(std::string_view charset) {
+   PROFILE_SCOPE("prerasterize");
+   constexpr size_t MinGlyphsPerWorker = 32;
+
+   std::vector<char32_t> codepoints;
+   for (size_t i = 0; i < charset.size();) {
+      char32_t c = nextCodepoint( charset, i );
+      if (c != '\n' && !atlas.find( c ) &&
+          std::find( codepoints.begin(), codepoints.end(), c ) == codepoints.end()) {
+         codepoints.push_back( c );
+      }
+   }
+   if (codepoints.empty()) {
+      return;
+   }
+
+   struct rendered_t {
+      char32_t c;
+      glyph_atlas_t::glyph_t glyph;
+      FT_Pos advance;
+      std::vector<unsigned char> pixels;
+   };
+
+   size_t threads = std::max( 1U, std::thread::hardware_concurrency() );
+   size_t workers = std::clamp( codepoints.size() / MinGlyphsPerWorker, (size_t)1, threads );
+   std::vector<FT_Face> faces( workers );
+   auto data = file->view();
+   for (auto &worker_face : faces) {
+      if (FT_New_Memory_Face(ft, (const FT_Byte *)data.data(), data.size(), 0, &worker_face) != 0 ||
+          FT_Set_Pixel_Sizes(worker_face, 0, size)) {
+         fmt::print("Failed to load face for prerasterizing: {},{}\n", name, size);
+         abort();
+      }
+   }
+
+   std::vector<std::vector<rendered_t>> results( workers );
+   auto rasterize = [&](size_t worker) {
+      PROFILE_SCOPE("rasterizeGlyphs");
+      FT_Face worker_face = faces[worker];
+      for (size_t i = worker; i < codepoints.size(); i += workers) {
+         FT_Load_Char(worker_face, codepoints[i], FT_LOAD_RENDER);
+         const auto slot = worker_face->glyph;
+         rendered_t &r = results[worker].emplace_back();
+         r.c = codepoints[i];
+         r.glyph.left = slot->bitmap_left;
+         r.glyph.top = slot->bitmap_top;
+         r.glyph.width = slot->bitmap.width;
+         r.glyph.height = slot->bitmap.rows;
+         r.advance = slot->advance.x;
+         r.pixels.resize( r.glyph.width * r.glyph.height );
+         for (int row = 0; row < r.glyph.height; row++) {
+            std::copy_n( slot->bitmap.buffer + row * slot->bitmap.pitch, r.glyph.width,
+                         r.pixels.begin() + row * r.glyph.width );
+         }
+      }
+   };
+   std::vector<std::future<void>> work;
+   for (size_t worker = 1; worker < workers; ++worker) {
+      work.push_back( std::async( std::launch::async, rasterize, worker ) );
+   }
+   rasterize( 0 );
+   for (auto &w : work) {
+      w.get();
+   }
+   for (auto &worker_face : faces) {
+      FT_Done_Face(worker_face);
+   }
+
+   {
+      PROFILE_SCOPE("packGlyphs");
+      std::vector<rendered_t *> order;
+      for (auto &result : results) {
+         for (auto &r : result) {
+            order.push_back( &r );
+         }
+      }
+      std::stable_sort( order.begin(), order.end(), [](const rendered_t *a, const rendered_t *b) {
+         return a->glyph.height > b->glyph.height;
+      } );
+      for (auto *r : order) {
+         atlas.add( r->c, r->glyph, r->pixels.data(), r->glyph.width );
+         if (!pixel_advances.find( r->c )) {
+            pixel_advances.insert( r->c, r->advance );
+         }
+      }
+   }
+}
+
+const glyph_atlas_t::glyph_t &PFontImpl::sdfGlyph(char32_t c) {
+   if (!sdf) {
+      const auto &path = fontFileMap[name];
+      auto &shared = sdfAtlases[path];
+      if (!shared) {
+         shared = std::make_shared<sdf_atlas_t>( fontFile( path ) );
+      }
+      sdf = shared;
+   }
+   return sdf->glyph( c );
+}
+
+// Places glyphs where render_as_pimage() draws them. Distance field glyphs
+// are scaled down from the reference size and keep their subpixel
+// position. The pen starts at x, y on the baseline, in 26.6.
+void PFontImpl::layoutLine(std::vector<PFont::glyph_quad_t> &quads, std::string_view line, FT_Pos x, FT_Pos y, bool use_sdf) {
+   float scale = use_sdf ? (float)size / PFont::SDFReferenceSize : 1.0F;
+   char32_t prev = 0;
+   for (size_t i = 0; i < line.size();) {
+      char32_t c = nextCodepoint( line, i );
+      if (prev) {
+         x += kerning( prev, c );
+      }
+      prev = c;
+      const auto &glyph = use_sdf ? sdfGlyph( c ) : atlasGlyph( c );
+      if (glyph.page >= 0) {
+         const PImage &page = use_sdf ? sdf->atlas.pages[glyph.page] : atlas.pages[glyph.page];
+         float left = use_sdf ? x / 64.0F + glyph.left * scale : x / 64 + glyph.left;
+         float top = use_sdf ? y / 64.0F - glyph.top * scale : y / 64 - glyph.top;
+         float page_width = page.width;
+         float page_height = page.height;
+         quads.push_back( { page,
+               { left, top },
+               { left + glyph.width * scale, top + glyph.height * scale },
+               { glyph.x / page_width, glyph.y / page_height },
+               { (glyph.x + glyph.width) / page_width, (glyph.y + glyph.height) / page_height } } );
+      }
+      x += pixelAdvance( c );
+   }
+}
+
+std::vector<PFont::glyph_quad_t> PFontImpl::layout(std::string_view text, bool use_sdf) {
+   std::vector<PFont::glyph_quad_t> quads;
+   quads.reserve( text.size() );
+   FT_Pos y = 0;
+   size_t start = 0;
+   while (true) {
+      size_t end = std::min( text.find( '\n', start ), text.size() );
+      layoutLine( quads, text.substr( start, end - start ), 0, y, use_sdf );
+      if (end == text.size()) {
+         break;
+      }
+      start = end + 1;
+      y += face->size->metrics.height;
+   }
+   return quads;
+}
+
+// Pen advance across one line, in 26.6.
+FT_Pos PFontImpl::lineAdvance(std::string_view line) {
+   FT_Pos x = 0;
+   char32_t prev = 0;
+   for (size_t i = 0; i < line.size();) {
+      char32_t c = nextCodepoint( line, i );
+      if (prev) {
+         x += kerning( prev, c );
+      }
+      x += pixelAdvance( c );
+      prev = c;
+   }
+   return x;
+}
+
+// Greedy word wrap. The advance is kept running along the line so each
+// line is one pass over its characters. A word too long for a line on its
+// own is broken between characters.
+std::vector<std::string_view> PFontImpl::wrap(std::string_view text, FT_Pos width) {
+   std::vector<std::string_view> lines;
+   size_t start = 0;
+   while (true) {
+      size_t end = std::min( text.find( '\n', start ), text.size() );
+      std::string_view rest = text.substr( start, end - start );
+      do {
+         // Break at the last space, or the end, reached within width.
+         size_t fit = 0;
+         FT_Pos x = 0;
+         char32_t prev = 0;
+         for (size_t i = 0;;) {
+            if (i == rest.size() || rest[i] == ' ') {
+               if (x > width) {
+                  break;
+               }
+               fit = i;
+               if (i == rest.size()) {
+                  break;
+               }
+            }
+            char32_t c = nextCodepoint( rest, i );
+            if (prev) {
+               x += kerning( prev, c );
+            }
+            x += pixelAdvance( c );
+            prev = c;
+         }
+         if (fit == 0) {
+            x = 0;
+            prev = 0;
+            for (size_t i = 0; i < rest.size();) {
+               size_t after = i;
+               char32_t c = nextCodepoint( rest, after );
+               FT_Pos next = x + (prev ? kerning( prev, c ) : 0) + pixelAdvance( c );
+               if (fit > 0 && next > width) {
+                  break;
+               }
+               x = next;
+               prev = c;
+               fit = i = after;
+            }
+         }
+         lines.push_back( rest.substr( 0, fit ) );
+         rest.remove_prefix( fit );
+         while (!rest.empty() && rest.front() == ' ') {
+            rest.remove_prefix( 1 );
+         }
+      } while (!rest.empty());
+      if (end == text.size()) {
+         break;
+      }
+      start = end + 1;
+   }
+   return lines;
+}
+
+// Lines that don't fit in the box are dropped. The same text drawn in
+// several boxes or alignments is cached once for each.
+const std::vector<PFont::glyph_quad_t> &PFontImpl::paragraph(std::string_view text, float width, float height,
+                                                             int align_x, int align_y, bool use_sdf) {
+   // As in Processing a box has no baseline of its own, text aligned to
+   // one starts at the top.
+   if (align_y == BASELINE) {
+      align_y = TOP;
+   }
+   paragraph_key_t key{ text, width, height, align_x, align_y, use_sdf };
+   auto existing = paragraph_index.find( key );
+   if (existing != paragraph_index.end()) {
+      paragraphs.splice( paragraphs.begin(), paragraphs, existing->second );
+      return paragraphs.front().quads;
+   }
+   paragraphs.push_front( { std::string( text ), key } );
+   auto &p = paragraphs.front();
+   p.key.text = p.text;
+   paragraph_index.emplace( p.key, paragraphs.begin() );
+   if (paragraphs.size() > MaxCachedParagraphs) {
+      paragraph_index.erase( paragraphs.back().key );
+      paragraphs.pop_back();
+   }
+
+   FT_Pos box_width = width * 64;
+   FT_Pos box_height = height * 64;
+   FT_Pos ascender = face->size->metrics.ascender;
+   FT_Pos descender = -face->size->metrics.descender;
+   FT_Pos line_height = face->size->metrics.height;
+
+   auto lines = wrap( p.text, box_width );
+   size_t fitting = 0;
+   while (fitting < lines.size() && (FT_Pos)fitting * line_height + ascender + descender <= box_height) {
+      fitting++;
+   }
+   lines.resize( fitting );
+   if (lines.empty()) {
+      return p.quads;
+   }
+
+   FT_Pos block = (lines.size() - 1) * line_height + ascender + descender;
+   FT_Pos y = ascender;
+   if (align_y == CENTER) {
+      y += (box_height - block) / 2;
+   } else if (align_y == BOTTOM) {
+      y += box_height - block;
+   }
+   for (auto line : lines) {
+      FT_Pos x = 0;
+      if (align_x == CENTER) {
+         x = (box_width - lineAdvance( line )) / 2;
+      } else if (align_x == RIGHT) {
+         x = box_width - lineAdvance( line );
+      }
+      layoutLine( p.quads, line, x, y, use_sdf );
+      y += line_height;
+   }
+   return p.quads;
+}
+
 float PFontImpl::textAscent() const {
    return face->size->metrics.ascender / 64.0F;
 }
@@ -220,42 +1102,85 @@ float PFontImpl::textDescent() const {
    return face->size->metrics.descender / 64.0F;
 }
 
+// Width of the widest line from glyph advances and kerning, nothing is
+// rasterized.
 float PFontImpl::textWidth(std::string_view text) {
-  return render_as_pimage(text).width;
+   FT_Pos width = 0;
+   size_t start = 0;
+   while (true) {
+      size_t end = std::min( text.find( '\n', start ), text.size() );
+      width = std::max( width, lineAdvance( text.substr( start, end - start ) ) );
+      if (end == text.size()) {
+         break;
+      }
+      start = end + 1;
+   }
+   return width / 64.0F;
+}
+
+void PFontImpl::trimWords() {
+   while (word_stats.bytes > word_cache_budget) {
+      auto &oldest = words.back();
+      word_index.erase( oldest.text );
+      word_stats.bytes -= oldest.bytes;
+      word_stats.evictions++;
+      words.pop_back();
+   }
+   word_stats.entries = words.size();
+}
+
+void PFontImpl::cacheWord(std::string text, PImage image) {
+   size_t bytes = (size_t)image.width * image.height * sizeof(unsigned int) * 2;
+   if (bytes > word_cache_budget) {
+      return;
+   }
+   words.push_front( { std::move(text), image, bytes } );
+   word_index.emplace( words.front().text, words.begin() );
+   word_stats.bytes += bytes;
+   trimWords();
 }
 
 PImage PFontImpl::render_as_pimage(std::string_view text_) {
 
-   std::string text = std::string(text_);
-   auto existing = words.find( text );
-   if ( existing != words.end() ) {
-      return existing->second;
+   auto existing = word_index.find( text_ );
+   if ( existing != word_index.end() ) {
+      word_stats.hits++;
+      words.splice( words.begin(), words, existing->second );
+      return existing->second->image;
    }
+   word_stats.misses++;
+
+   std::string text = std::string(text_);
+   int ascender = face->size->metrics.ascender / 64;
 
    // Get the width and height of the bitmap
    int width = 0;
    int height = 0;
    {
-      int x = 0; // Current X position
-      int y = 0; // Current Y position
+      FT_Pos x = 0; // Current X position
+      FT_Pos y = 0; // Current Y position
+      char32_t prev = 0;
 
-      for (size_t i = 0; text[i] != '\0'; i++) {
-         if (text[i] == '\n') {
+      for (size_t i = 0; i < text.size();) {
+         char32_t c = nextCodepoint( text, i );
+         if (c == '\n') {
             x = 0;
             y += face->size->metrics.height;
+            prev = 0;
          } else {
-            FT_Load_Char(face, text[i], FT_LOAD_RENDER);
-            auto baseline_offset = (face->size->metrics.ascender);
+            if (prev) {
+               x += kerning( prev, c );
+            }
+            prev = c;
+            const auto &glyph = atlasGlyph( c );
 
-            int oX = (x/64) + face->glyph->bitmap_left;
-            int oY = (baseline_offset/64) + (y/64) - face->glyph->bitmap_top;
+            int oX = (x/64) + glyph.left;
+            int oY = ascender + (y/64) - glyph.top;
 
-            int destY = oY + face->glyph->bitmap.rows;
-            height = std::max( destY, height );
-            int destX = oX + face->glyph->bitmap.width;
-            width = std::max( destX, width );
+            height = std::max( oY + glyph.height, height );
+            width = std::max( oX + glyph.width, width );
 
-            x += face->glyph->advance.x;
+            x += pixelAdvance( c );
          }
       }
    }
@@ -265,39 +1190,46 @@ PImage PFontImpl::render_as_pimage(std::string_view text_) {
    // Makesure texture is clear
    std::fill( image._pixels(), image._pixels() + (width * height), 0);
 
-   int x = 0; // Current X position
-   int y = 0; // Current Y position
+   FT_Pos x = 0; // Current X position
+   FT_Pos y = 0; // Current Y position
+   char32_t prev = 0;
 
-   for (size_t i = 0; text[i] != '\0'; i++) {
-      if (text[i] == '\n') {
+   // Glyphs are copied out of the atlas rather than rendered again.
+   for (size_t i = 0; i < text.size();) {
+      char32_t c = nextCodepoint( text, i );
+      if (c == '\n') {
          x = 0;
          y += face->size->metrics.height;
+         prev = 0;
       } else {
-         FT_Load_Char(face, text[i], FT_LOAD_RENDER);
-
-         auto baseline_offset = (face->size->metrics.ascender);
-
-         int oX = (x/64) + face->glyph->bitmap_left;
-         int oY = (baseline_offset/64) + (y/64) - face->glyph->bitmap_top;
-
-         // Render the text into the PImage
-         for (int row = 0; row < face->glyph->bitmap.rows; row++) {
-            int destY = oY + row;
-            for (int col = 0; col < face->glyph->bitmap.width; col++) {
-               int destX = oX + col;
-               int srcIndex = col + row * face->glyph->bitmap.pitch;
-               int destIndex = destX + destY * width;
-               if (destX < width && destY < height) {
-                  image.pixels[destIndex] = color( 255,255,255, face->glyph->bitmap.buffer[srcIndex]);
+         if (prev) {
+            x += kerning( prev, c );
+         }
+         prev = c;
+         const auto &glyph = atlasGlyph( c );
+
+         int oX = (x/64) + glyph.left;
+         int oY = ascender + (y/64) - glyph.top;
+
+         if (glyph.page >= 0) {
+            const PImage &page = atlas.pages[glyph.page];
+            const unsigned int *source = page._pixels();
+            for (int row = 0; row < glyph.height; row++) {
+               int destY = oY + row;
+               for (int col = 0; col < glyph.width; col++) {
+                  int destX = oX + col;
+                  if (destX >= 0 && destY >= 0 && destX < width && destY < height) {
+                     image.pixels[destX + destY * width] = source[glyph.x + col + (glyph.y + row) * page.width];
+                  }
                }
             }
          }
 
          // Advance to the next position
-         x += face->glyph->advance.x;
+         x += pixelAdvance( c );
       }
    }
-   words[text] = image;
+   cacheWord( std::move(text), image );
    return image;
 }
 
@@ -312,17 +1244,10 @@ void textSize(int size) {
 }
 
 
-static std::vector<std::weak_ptr<PFontImpl>> &fontHandles() {
-   static std::vector<std::weak_ptr<PFontImpl>> handles;
-   return handles;
-}
-
 static void PFont_releaseAllFonts() {
-   for (const auto &i : fontHandles()) {
-      if (auto p = i.lock()) {
-         p->releaseFace();
-      }
-   }
+   PFontImpl::for_each( [](PFontImpl &p) {
+      p.releaseFace();
+   } );
 }
 
 void PFont::init() {
@@ -333,12 +1258,21 @@ void PFont::init() {
    }
    FT_Int major, minor, patch;
    FT_Library_Version(ft, &major, &minor, &patch);
+   FT_Int spread = PFont::SDFSpread;
+   FT_Property_Set(ft, "sdf", "spread", &spread);
 }
 
 
 void PFont::close() {
+   fontCacheIndex.clear();
+   fontCache.clear();
    PFont_releaseAllFonts();
+   for (auto &[path, atlas] : sdfAtlases) {
+      atlas->release();
+   }
+   sdfAtlases.clear();
    FT_Done_FreeType(ft);
+   fontFiles.clear();
 }
 
 PFont::PFont() = default;
@@ -346,14 +1280,22 @@ PFont::PFont() = default;
 PFont::~PFont() = default;
 
 PFont::PFont(const char *name_, int size_)
-   : impl(std::make_shared<PFontImpl>(name_,size_)) {
-   fontHandles().push_back( impl );
+   : impl(cachedFont(name_,size_)) {
+}
+
+PFont::PFont(const char *name_, int size_, std::string_view charset)
+   : impl(cachedFont(name_,size_)) {
+   impl->prerasterize(charset);
 }
 
 const char *PFont::getName() const {
    return impl->name;
 }
 
+int PFont::getSize() const {
+   return impl->size;
+}
+
 PShape PFont::render_as_pshape(std::string_view text) const {
    return impl->render_as_pshape(text);
 }
@@ -362,6 +1304,26 @@ PImage PFont::render_as_pimage(std::string_view text) {
    return impl->render_as_pimage(text);
 }
 
+std::vector<PFont::glyph_quad_t> PFont::layout(std::string_view text, bool sdf) {
+   return impl->layout(text, sdf);
+}
+
+const std::vector<PFont::glyph_quad_t> &PFont::layout(std::string_view text, float width, float height,
+                                                      int align_x, int align_y, bool sdf) {
+   return impl->paragraph(text, width, height, align_x, align_y, sdf);
+}
+
+void PFont::setWordCacheBudget(size_t bytes) {
+   PFontImpl::word_cache_budget = bytes;
+   PFontImpl::for_each( [](PFontImpl &p) {
+      p.trimWords();
+   } );
+}
+
+PFont::cache_stats_t PFont::wordCacheStats() const {
+   return impl->word_stats;
+}
+
 float PFont::textAscent() const {
    return impl->textAscent();
 }
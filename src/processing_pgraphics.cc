@@ -1,17 +1,16 @@
 #include "processing_pgraphics.h"
 #include "processing_debug.h"
+#include "processing_profile.h"
+#include "processing_registry.h"
 #include "mapbox/pixelmatch.hpp"
 #include <cmath>
+#include <map>
+#include <array>
 #include <stb_image.h>
 
 #undef DEBUG_METHOD
 #define DEBUG_METHOD() do {} while (false)
 
-static std::vector<std::weak_ptr<PGraphicsImpl>> &graphicsHandles() {
-   static std::vector<std::weak_ptr<PGraphicsImpl>> handles;
-   return handles;
-}
-
 static PVector posOnUnitSquare( float angle ) {
    float x = 2 * sinf(-angle + HALF_PI);
    float y = 2 * cosf(-angle + HALF_PI);
@@ -36,7 +35,7 @@ static PVector posOnUnitCircle( float angle ) {
    return { sinf(-angle + HALF_PI), cosf(-angle + HALF_PI) };
 }
 
-class PGraphicsImpl {
+class PGraphicsImpl : public registered_t<PGraphicsImpl> {
 public:
    static void init();
 
@@ -67,8 +66,46 @@ public:
 
    float xsphere_ures = 30;
    float xsphere_vres = 30;
+   // Until sphereDetail() is called spheres pick their own detail from
+   // how big they'll be on screen, as do ellipses and arcs.
+   bool sphere_detail_set = false;
+   int lod_min = 8;
+   int lod_max = 256;
+   // Until circleDetail() is called the detail only follows the size for
+   // circles smaller or larger on screen than this many pixels radius. In
+   // between they keep the 32 segments, and spheres the 30x30, they always
+   // had so sketches drawn at ordinary sizes look the same as they did.
+   bool circle_detail_set = false;
+   static constexpr float FixedDetailMin = 2.0F;
+   static constexpr float FixedDetailMax = 1024.0F;
+   static constexpr int FixedCircleSegments = 32;
+
+   // Meshes for box() and sphere() kept around so they aren't rebuilt
+   // every call. Spheres are unit sized and scaled at draw time. Each
+   // keeps restyled copies for the last few styles it was drawn in so
+   // drawing one in a recent style is only a flatten into the batch.
+   struct styled_mesh_t {
+      PShape shape;
+      float weight_scale;
+   };
+   struct cached_mesh_t {
+      PShape mesh;
+      std::vector<styled_mesh_t> styles;
+      uint64_t last_used = 0;
+   };
+   std::map<std::array<float,3>, cached_mesh_t> box_meshes;
+   std::map<std::pair<int,int>, cached_mesh_t> sphere_meshes;
+   uint64_t mesh_uses = 0;
+   static constexpr size_t MaxCachedMeshes = 64;
+   static constexpr size_t MaxCachedStyles = 8;
 
    PShape _shape;
+   // Reused by the immediate mode primitives that still build a shape, so
+   // drawing a line() or triangle() doesn't allocate and register a new
+   // shape each call.
+   PShape scratch;
+   // Outline of the convex primitive being drawn straight into the batch.
+   std::vector<PVector> outline;
    std::vector<unsigned int> pixels;
 
    std::vector<PMatrix> matrix_stack;
@@ -76,9 +113,28 @@ public:
    PShader defaultShader;
    PShader currentShader;
    PShader flatShader;
+   PShader sdfShader;
 
    int flushes = 0;
 
+   bool depth_sort = false;
+   // Shapes are culled against their bounds. Vertex shaders that move
+   // geometry can make those wrong, so there's no culling under a custom
+   // shader and hint(DISABLE_FRUSTUM_CULLING) turns it off for any other.
+   bool frustum_culling = true;
+   // Microseconds spent depth sorting in the current and the last frame.
+   long long depth_sort_time = 0;
+   long long last_depth_sort_time = 0;
+
+   // With SDF text on glyphs come from distance fields shared by every
+   // font size. Those glyphs need their own shader so the batch holding
+   // them is flushed separately from other geometry.
+   bool sdf_text = false;
+   bool sdf_batch = false;
+   bool drawing_sdf = false;
+   color text_outline = { 0.0F, 0.0F, 0.0F };
+   float text_outline_weight = 0;
+
    glm::vec3 falloff = {1.0,0.0,0.0};
    glm::vec3 specular = {0.0,0.0,0.0};
 
@@ -105,7 +161,8 @@ public:
       localFrame(width, height, aaMode, aaFactor),
       pixelsFrame(width, height, SSAA, 1),
       windowFrame( width, height ),
-      _shape( createShape() ) {
+      _shape( createShape() ),
+      scratch( createShape() ) {
 
       batch = std::make_shared<gl::batch_t>();
       DEBUG_METHOD();
@@ -117,6 +174,7 @@ public:
       defaultShader = loadShader();
       shader( defaultShader );
       flatShader = loadFlatShader();
+      sdfShader = loadSDFShader();
       noLights();
       camera();
       perspective();
@@ -130,6 +188,7 @@ public:
       defaultShader = {};
       currentShader = {};
       flatShader = {};
+      sdfShader = {};
       windowFrame.release_shader();
       windowFrame = gl::mainframe_t();;
       localFrame = {};
@@ -148,9 +207,27 @@ public:
 
    void flush() {
       if ( batch->size() > 0 ) {
-         frame.add( batch, scene, getBestShader(*batch).getShader() );
-         batch = std::make_shared<gl::batch_t>();
+         auto translucent = depth_sort ? sortTranslucent() : nullptr;
+         frame.add( batch, scene, sdf_batch ? sdfShader.getShader() : getBestShader(*batch).getShader() );
+         if ( translucent ) {
+            frame.add( translucent, scene, sdf_batch ? sdfShader.getShader() : getBestShader(*translucent).getShader() );
+         }
+         auto next = std::make_shared<gl::batch_t>();
+         // The scratch buffers are only used while building, hand them on.
+         next->scratch = std::move( batch->scratch );
+         batch = next;
       }
+      sdf_batch = false;
+   }
+
+   // With depth sorting on, translucent triangles are drawn after the rest
+   // of the batch, back to front.
+   gl::batch_t_ptr sortTranslucent() {
+      PROFILE_SCOPE("depthSort");
+      auto start = Profile::getTime();
+      auto sorted = batch->extractTranslucent( scene.viewMatrix() );
+      depth_sort_time += Profile::getTime() - start;
+      return sorted;
    }
 
    void directDraw( gl::batch_t_ptr batch, const PMatrix &transform ) {
@@ -408,15 +485,68 @@ public:
 
    void hint(int type) {
       flush();
-      scene.hint(type);
+      switch (type) {
+      case ENABLE_DEPTH_SORT:
+         depth_sort = true;
+         break;
+      case DISABLE_DEPTH_SORT:
+         depth_sort = false;
+         break;
+      case ENABLE_SDF_TEXT:
+         sdf_text = true;
+         break;
+      case DISABLE_SDF_TEXT:
+         sdf_text = false;
+         break;
+      case ENABLE_FRUSTUM_CULLING:
+         frustum_culling = true;
+         break;
+      case DISABLE_FRUSTUM_CULLING:
+         frustum_culling = false;
+         break;
+      default:
+         scene.hint(type);
+         break;
+      }
+   }
+
+   float depthSortMillis() const {
+      return last_depth_sort_time / 1000.0F;
+   }
+
+   // Outlines only apply to SDF text, weight is in pixels at the current
+   // text size and is limited by PFont::SDFSpread.
+   void textOutline(color c, float weight) {
+      text_outline = c;
+      text_outline_weight = weight;
+   }
+
+   void noTextOutline() {
+      text_outline_weight = 0;
    }
 
    void text(const std::string &text, float x, float y, float twidth = -1, float theight = -1) {
+      // Changing blend mode flushes so only do it if we have to.
+      bool blend = scene.getBlendMode() != BLEND;
+      int mode = blend ? blendMode(BLEND) : BLEND;
+      if ( twidth > 0 && theight > 0 ) {
+         drawGlyphs( currentFont.layout(text, twidth, theight, xTextAlign, yTextAlign, sdf_text), x, y );
+      } else {
+         textLine( text, x, y );
+      }
+      if (blend) {
+         blendMode(mode);
+      }
+   }
 
-      PImage text_image = currentFont.render_as_pimage(text);
+   void textLine(const std::string &text, float x, float y) {
 
-      twidth = text_image.width;
-      theight = text_image.height;
+      auto glyphs = currentFont.layout(text, sdf_text);
+
+      float twidth = 0;
+      for (const auto &glyph : glyphs) {
+         twidth = std::max( twidth, glyph.bottomRight.x );
+      }
 
       float ascent = currentFont.textAscent();
 
@@ -424,22 +554,60 @@ public:
       if ( xTextAlign == CENTER ) {
          x = x - twidth / 2.0F;
       }
+      if ( xTextAlign == RIGHT ) {
+         x = x - twidth;
+      }
+      if ( yTextAlign == BASELINE ) {
+         // Glyphs are laid out with the first baseline at zero.
+         drawGlyphs( glyphs, x, y );
+         return;
+      }
       if ( yTextAlign == CENTER ) {
          y = y - ascent / 2.0F;
       } else {
          y = y - ascent;
       }
-      if ( xTextAlign == RIGHT ) {
-         x = x - twidth;
-      }
-      if ( yTextAlign == RIGHT ) {
+      if ( yTextAlign == RIGHT || yTextAlign == BOTTOM ) {
          y = y - ascent;
       }
 
-      auto mode = blendMode(BLEND);
-      drawTexturedQuad({x,y},{x+twidth,y},{x+twidth,y+theight},{x,y+theight},
-                       text_image, _shape.getFillColor() );
-      blendMode(mode);
+      drawGlyphs( glyphs, x, y + ascent );
+   }
+
+   // One textured quad per glyph, glyphs on the same atlas page go into the
+   // batch as a single shape.
+   void drawGlyphs(const std::vector<PFont::glyph_quad_t> &glyphs, float x, float y) {
+      size_t i = 0;
+      while (i < glyphs.size()) {
+         const PImage &page = glyphs[i].page;
+         PShape &quads = scratchShape();
+         quads.textureMode(NORMAL);
+         quads.texture(page);
+         quads.tint( _shape.getFillColor() );
+         quads.beginShape(TRIANGLES_NOSTROKE);
+         unsigned short n = 0;
+         if (sdf_text) {
+            // The field spans SDFSpread reference pixels either side of the
+            // edge, 0.5 in distance units.
+            float pixels = PFont::SDFSpread * (float)currentFont.getSize() / PFont::SDFReferenceSize;
+            quads.emissive( text_outline.r, text_outline.g, text_outline.b );
+            quads.shininess( std::clamp( 0.5F * text_outline_weight / pixels, 0.0F, 0.49F ) );
+         }
+         for (; i < glyphs.size() && glyphs[i].page == page && n < 65532; ++i, n += 4) {
+            const auto &g = glyphs[i];
+            quads.vertex( PVector{ x + g.topLeft.x,     y + g.topLeft.y },     { g.uvTopLeft.x,     g.uvTopLeft.y } );
+            quads.vertex( PVector{ x + g.bottomRight.x, y + g.topLeft.y },     { g.uvBottomRight.x, g.uvTopLeft.y } );
+            quads.vertex( PVector{ x + g.bottomRight.x, y + g.bottomRight.y }, { g.uvBottomRight.x, g.uvBottomRight.y } );
+            quads.vertex( PVector{ x + g.topLeft.x,     y + g.bottomRight.y }, { g.uvTopLeft.x,     g.uvBottomRight.y } );
+            for (unsigned short k : { 0,1,2, 0,2,3 }) {
+               quads.index( n + k );
+            }
+         }
+         quads.endShape();
+         drawing_sdf = sdf_text;
+         shape( quads );
+         drawing_sdf = false;
+      }
    }
 
    void text(char c, float x, float y, float twidth = -1, float theight = -1) {
@@ -478,11 +646,16 @@ public:
    }
 
    PShape createBox(float w, float h, float d) {
+      PShape cube = createShape();
+      buildBox(cube, w, h, d);
+      return cube;
+   }
+
+   void buildBox(PShape &cube, float w, float h, float d) {
       w = w / 2;
       h = h / 2;
       d = d / 2;
 
-      PShape cube = createShape();
       cube.beginShape(QUADS);
       cube.copyStyle( _shape );
       cube.textureMode(NORMAL);
@@ -536,37 +709,127 @@ public:
          } );
 
       cube.endShape();
-      return cube;
    }
 
    void box(float w, float h, float d) {
-      auto b =  createBox(w,h,d);
-      shape( b );
+      auto &cached = cachedMesh( box_meshes, {w, h, d}, [&] { return createBox(w, h, d); } );
+      drawMesh( cached, 1.0F, 1.0F );
+   }
+
+   // Find key in cache, building it if it's missing. A full cache drops
+   // whichever mesh went unused longest.
+   template <typename K, typename F>
+   cached_mesh_t &cachedMesh( std::map<K, cached_mesh_t> &cache, const K &key, F build ) {
+      auto i = cache.find( key );
+      if (i == cache.end()) {
+         if (cache.size() >= MaxCachedMeshes) {
+            cache.erase( std::min_element( cache.begin(), cache.end(), [](const auto &a, const auto &b) {
+               return a.second.last_used < b.second.last_used;
+            } ) );
+         }
+         i = cache.emplace( key, cached_mesh_t{ build(), {} } ).first;
+      }
+      i->second.last_used = ++mesh_uses;
+      return i->second;
+   }
+
+   void drawMesh( cached_mesh_t &cached, float scale, float weight_scale ) {
+      auto &styles = cached.styles;
+      auto i = std::find_if( styles.begin(), styles.end(), [&](const styled_mesh_t &s) {
+         return s.shape.sameStyle( _shape ) && (s.weight_scale == weight_scale || !_shape.isStroked());
+      } );
+      // The most recently used style is kept at the back.
+      if (i != styles.end()) {
+         std::rotate( i, i + 1, styles.end() );
+      } else {
+         if (styles.size() < MaxCachedStyles) {
+            styles.push_back( { cached.mesh.copy(), weight_scale } );
+         } else {
+            std::rotate( styles.begin(), styles.begin() + 1, styles.end() );
+         }
+         auto &styled = styles.back();
+         styled.shape.restyle( _shape, weight_scale );
+         styled.weight_scale = weight_scale;
+      }
+      // Scaled through the transform rather than the mesh's own matrix so
+      // the cached mesh itself never changes.
+      PMatrix transform = _shape.getShapeMatrix();
+      if (scale != 1.0F) {
+         transform = transform * PMatrix( { scale, 0.0F, 0.0F, 0.0F },
+                                          { 0.0F, scale, 0.0F, 0.0F },
+                                          { 0.0F, 0.0F, scale, 0.0F },
+                                          { 0.0F, 0.0F, 0.0F, 1.0F } );
+      }
+      flattenShape( styles.back().shape, transform, frustum_culling && currentShader == defaultShader );
+      pixels_current = false;
+      blitPixels();
    }
 
    void sphereDetail(float ures, float vres) {
       xsphere_ures = ures;
       xsphere_vres = vres;
+      sphere_detail_set = true;
+   }
+
+   void circleDetail(int min_segments, int max_segments) {
+      lod_min = std::max( 4, min_segments );
+      lod_max = std::max( lod_min, max_segments );
+      circle_detail_set = true;
+   }
+
+   // Radius in pixels a circle around the given point would have on
+   // screen if drawn with the current transform and projection.
+   float projectedRadius(PVector center, float radius) {
+      const PMatrix &m = _shape.getShapeMatrix();
+      PVector world = m * center;
+      return radius * maxScale( m ) * scene.pixelScale( {world.x, world.y, world.z}, height );
+   }
+
+   bool fixedDetail(float projected) const {
+      return !circle_detail_set && projected >= FixedDetailMin && projected <= FixedDetailMax;
+   }
+
+   int circleSegments(PVector center, float radius) {
+      float projected = projectedRadius( center, radius );
+      if (fixedDetail( projected )) {
+         return FixedCircleSegments;
+      }
+      return ::circleSegments( projected, lod_min, lod_max );
+   }
+
+   std::pair<int,int> sphereResolution( float radius ) {
+      float projected = projectedRadius( {0, 0, 0}, radius );
+      if (sphere_detail_set || fixedDetail( projected )) {
+         return { (int)xsphere_ures, (int)xsphere_vres };
+      }
+      int vres = ::circleSegments( projected, lod_min, lod_max );
+      return { vres / 2, vres };
    }
 
    PShape createSphere( float radius ) {
       PShape sphere = createShape();
+      auto [ ures, vres ] = sphereResolution( radius );
+      buildSphere( sphere, radius, ures, vres );
+      return sphere;
+   }
+
+   void buildSphere( PShape &sphere, float radius, int ures, int vres ) {
       sphere.beginShape(TRIANGLES);
       sphere.copyStyle( _shape );
       sphere.textureMode(NORMAL);
 
-      float latStep = PI / xsphere_ures;
-      float lonStep = 2 * PI / xsphere_vres;
+      // Latitude only goes half way round so it uses a table with twice
+      // the resolution.
+      const auto &lat = sinCosTable( 2 * ures );
+      const auto &lon = sinCosTable( vres );
 
-      for (int i = 0; i <= xsphere_ures; i++) {
-         float lat = i * latStep;
-         float cosLat = std::cos(lat);
-         float sinLat = std::sin(lat);
+      for (int i = 0; i <= ures; i++) {
+         float cosLat = lat[i][0];
+         float sinLat = lat[i][1];
 
-         for (int j = 0; j <= xsphere_vres; j++) {
-            float lon = j * lonStep;
-            float cosLon = std::cos(lon);
-            float sinLon = std::sin(lon);
+         for (int j = 0; j <= vres; j++) {
+            float cosLon = lon[j][0];
+            float sinLon = lon[j][1];
 
             float x = sinLat * cosLon;
             float y = cosLat;
@@ -574,16 +837,16 @@ public:
 
             sphere.normal( {x,y,z} );
             sphere.vertex( x * radius, y * radius, z * radius,
-                           map(j,0,xsphere_vres+1, 1.0, 0.0),
-                           map(i,0,xsphere_ures+1, 1.0, 0.0));
+                           map(j,0,vres+1, 1.0, 0.0),
+                           map(i,0,ures+1, 1.0, 0.0));
          }
       }
 
-      for (int i = 0; i < xsphere_ures; i++) {
-         for (int j = 0; j < xsphere_vres; j++) {
-            int idx0 = i * (xsphere_vres+1) + j;
+      for (int i = 0; i < ures; i++) {
+         for (int j = 0; j < vres; j++) {
+            int idx0 = i * (vres+1) + j;
             int idx1 = idx0 + 1;
-            int idx2 = (i+1) * (xsphere_vres+1) + j;
+            int idx2 = (i+1) * (vres+1) + j;
             int idx3 = idx2 + 1;
             sphere.index(idx1);
             sphere.index(idx2);
@@ -594,12 +857,20 @@ public:
          }
       }
       sphere.endShape();
-      return sphere;
    }
 
    void sphere(float radius) {
-      PShape sphere = createSphere(radius);
-      shape( sphere );
+      if (radius <= 0.0F) {
+         return;
+      }
+      auto resolution = sphereResolution( radius );
+      auto &cached = cachedMesh( sphere_meshes, resolution, [&] {
+         PShape mesh = createShape();
+         buildSphere( mesh, 1.0F, resolution.first, resolution.second );
+         return mesh;
+      } );
+      // Strokes are built in the mesh's own units so undo the scale on them.
+      drawMesh( cached, radius, 1.0F / radius );
    }
 
    // // Doesn't work becuase we need to flip the texture on Y axis
@@ -710,10 +981,32 @@ public:
       image(i,x,y);
    }
 
+   PShape &scratchShape() {
+      scratch.reset();
+      return scratch;
+   }
+
+   // Untextured rects and ellipses skip building a shape and go straight
+   // into the batch.
+   void drawOutline(std::optional<PVector> normal = {}) {
+      if ( sdf_batch != drawing_sdf ) {
+         flush();
+         sdf_batch = drawing_sdf;
+      }
+      _shape.draw_convex( batch, _shape.getShapeMatrix(), outline, normal );
+      pixels_current = false;
+      blitPixels();
+   }
+
    void rect(float x, float y, float _width, float _height) {
-      PShape rect = createRect(x,y,_width,_height);
-      shape( rect );
-//      rect_opt = std::move( rect );
+      if (_shape.isTextureSet()) {
+         buildRect(scratchShape(), x, y, _width, _height);
+         shape( scratch );
+         return;
+      }
+      applyRectMode(x, y, _width, _height);
+      outline = { {x,y}, {x+_width,y}, {x+_width,y+_height}, {x,y+_height} };
+      drawOutline( PVector{0,0,1} );
    }
 
    void ellipseMode(int mode) {
@@ -722,7 +1015,7 @@ public:
 
    void drawTexturedQuad(PVector p0, PVector p1, PVector p2, PVector p3,
                          PImage texture, color tint = WHITE, bool flipY = false ) {
-      PShape quad = createShape();
+      PShape &quad = scratchShape();
       quad.textureMode(NORMAL);
       quad.texture(texture);
       quad.tint( tint );
@@ -738,7 +1031,9 @@ public:
          quad.vertex( p2, {1.0, 1.0} );
          quad.vertex( p3, {0.0, 1.0} );
       }
-      quad.index( { 0,1,2, 0,2,3 } );
+      for (unsigned short i : { 0,1,2, 0,2,3 }) {
+         quad.index( i );
+      }
       quad.endShape();
 
       shape( quad );
@@ -760,58 +1055,81 @@ public:
    }
 
    void shape(PShape &pshape) {
-      if( pshape.isCompiled() ) {
+      // Immediate mode primitives are cheaper to draw than to cull.
+      bool cull = frustum_culling && currentShader == defaultShader && pshape != scratch;
+      if( pshape.updateCompiled() ) {
+         PMatrix view_projection = scene.projectionView();
+         if ( cull && pshape.outsideFrustum( pshape == _shape ? view_projection :
+                                             view_projection * _shape.getShapeMatrix() ) ) {
+            return;
+         }
          flush();
          auto local = pshape.getBatch();
          if (pshape == _shape) {
-            directDraw( local, PMatrix::Identity() );
+            directDraw( local, pshape.getShapeMatrix() );
          } else {
-            directDraw( local, _shape.getShapeMatrix() );
+            directDraw( local, _shape.getShapeMatrix() * pshape.getShapeMatrix() );
          }
+      } else if (pshape == _shape) {
+         flattenShape( pshape, PMatrix::Identity(), cull );
       } else {
-         if (pshape == _shape) {
-            pshape.flatten( batch, PMatrix::Identity(), false );
-         } else {
-            pshape.flatten( batch, _shape.getShapeMatrix(), false );
-         }
+         flattenShape( pshape, _shape.getShapeMatrix(), cull );
       }
       pixels_current = false;
       blitPixels();
    }
 
+   void flattenShape(const PShape &pshape, const PMatrix &transform, bool cull) {
+      if ( sdf_batch != drawing_sdf ) {
+         flush();
+         sdf_batch = drawing_sdf;
+      }
+      // Flattening culls the shape and each child against the frustum,
+      // reusing the last result for any that haven't moved.
+      PMatrix view_projection = scene.projectionView();
+      pshape.flatten( batch, transform, false, cull ? &view_projection : nullptr );
+   }
+
    void ellipse(float x, float y, float width, float height) {
-      PShape pshape = createEllipse(x, y, width, height);
-      shape( pshape );
+      if (_shape.isStroked() && !_shape.isTextureSet() &&
+          !(_shape.isFilled() && _shape.getFillColor() == _shape.getStrokeColor())) {
+         applyEllipseMode(x, y, width, height);
+         ellipseOutline(x, y, width, height);
+         drawOutline();
+      } else {
+         buildEllipse(scratchShape(), x, y, width, height);
+         shape( scratch );
+      }
    }
 
    void arc(float x, float y, float width, float height, float start, float stop, int mode = DEFAULT) {
-      PShape pshape = createArc(x, y, width, height, start, stop, ellipse_mode,  mode);
-      shape( pshape );
+      buildArc(scratchShape(), x, y, width, height, start, stop, ellipse_mode,  mode);
+      shape( scratch );
    }
 
    void line(float x1, float y1, float z1, float x2, float y2, float z2) {
-      PShape pshape = createLine( x1, y1, z1, x2, y2, z2);
-      shape( pshape );
+      buildLine(scratchShape(), x1, y1, z1, x2, y2, z2);
+      shape( scratch );
    }
 
    void point(float x, float y) {
-      PShape pshape = createPoint(x, y);
-      shape( pshape );
+      buildPoint(scratchShape(), x, y);
+      shape( scratch );
    }
 
    void quad( float x1, float y1, float x2, float y2, float x3, float y3, float x4, float y4 ) {
-      PShape pshape = createQuad(x1, y1, x2, y2, x3, y3, x4, y4);
-      shape( pshape );
+      buildQuad(scratchShape(), x1, y1, x2, y2, x3, y3, x4, y4);
+      shape( scratch );
    }
 
    void triangle( float x1, float y1, float x2, float y2, float x3, float y3 ) {
-      PShape pshape = createTriangle( x1, y1, x2, y2, x3, y3 );
-      shape( pshape );
+      buildTriangle(scratchShape(), x1, y1, x2, y2, x3, y3 );
+      shape( scratch );
    }
 
    void bezier(float x1, float y1, float x2, float y2, float x3, float y3, float x4, float y4) {
-      PShape pshape = createBezier(x1, y1, x2, y2, x3, y3, x4, y4);
-      shape( pshape );
+      buildBezier(scratchShape(), x1, y1, x2, y2, x3, y3, x4, y4);
+      shape( scratch );
    }
 
    void endShape(int type = OPEN) {
@@ -824,17 +1142,27 @@ public:
    }
 
    PShape createBezier(float x1, float y1, float x2, float y2, float x3, float y3, float x4, float y4) {
-      PShape bezier = createShape();
+      PShape shape = createShape();
+      buildBezier(shape, x1, y1, x2, y2, x3, y3, x4, y4);
+      return shape;
+   }
+
+   void buildBezier(PShape &bezier, float x1, float y1, float x2, float y2, float x3, float y3, float x4, float y4) {
       bezier.beginShape(POLYGON);
       bezier.copyStyle( _shape );
+      bezier.setCurveTolerance( CURVE_TOLERANCE / maxScale( _shape.getShapeMatrix() ) );
       bezier.vertex(x1, y1);
       bezier.bezierVertex(x2, y2, x3, y3, x4, y4);
       bezier.endShape(OPEN);
-      return bezier;
    }
 
-//   PShape rect_opt;
    PShape createRect(float x, float y, float width, float height) {
+      PShape shape = createShape();
+      buildRect(shape, x, y, width, height);
+      return shape;
+   }
+
+   void applyRectMode(float &x, float &y, float &width, float &height) const {
       if (rect_mode == CORNERS) {
          width = width - x;
          height = height - y;
@@ -847,7 +1175,10 @@ public:
          x = x - width / 2;
          y = y - height / 2;
       }
-      PShape shape = createShape();//( std::move(rect_opt) );
+   }
+
+   void buildRect(PShape &shape, float x, float y, float width, float height) {
+      applyRectMode(x, y, width, height);
       shape.beginShape(CONVEX_POLYGON);
       shape.copyStyle( _shape );
       shape.normal(0,0,1);
@@ -855,13 +1186,17 @@ public:
       shape.vertex(x+width,y);
       shape.vertex(x+width,y+height);
       shape.vertex(x,y+height);
-      shape.index( { 0,1,2,0,2,3 } );
+      // Triangle fan gives 0,1,2,0,2,3 without building an index list.
       shape.endShape(CLOSE);
-      return shape;
    }
 
    PShape createQuad( float x1, float y1, float x2, float y2, float x3, float y3, float x4, float y4 ) {
       PShape shape = createShape();
+      buildQuad(shape, x1, y1, x2, y2, x3, y3, x4, y4);
+      return shape;
+   }
+
+   void buildQuad( PShape &shape, float x1, float y1, float x2, float y2, float x3, float y3, float x4, float y4 ) {
       shape.beginShape(POLYGON);
       shape.copyStyle( _shape );
       shape.vertex(x1, y1);
@@ -869,29 +1204,38 @@ public:
       shape.vertex(x3, y3);
       shape.vertex(x4, y4);
       shape.endShape(CLOSE);
-      return shape;
    }
 
    PShape createLine(float x1, float y1, float z1, float x2, float y2, float z2) {
       PShape shape = createShape();
+      buildLine(shape, x1, y1, z1, x2, y2, z2);
+      return shape;
+   }
+
+   void buildLine(PShape &shape, float x1, float y1, float z1, float x2, float y2, float z2) {
       shape.beginShape(POLYGON);
       shape.copyStyle( _shape );
       shape.vertex(x1,y1,z1);
       shape.vertex(x2,y2,z2);
       shape.endShape(OPEN);
-      return shape;
    }
 
    PShape createTriangle( float x1, float y1, float x2, float y2, float x3, float y3 ) {
       PShape shape = createShape();
+      buildTriangle(shape, x1, y1, x2, y2, x3, y3);
+      return shape;
+   }
+
+   void buildTriangle( PShape &shape, float x1, float y1, float x2, float y2, float x3, float y3 ) {
       shape.beginShape(TRIANGLES);
       shape.copyStyle( _shape );
       shape.vertex(x1, y1);
       shape.vertex(x2, y2);
       shape.vertex(x3, y3);
-      shape.index( { 0,1,2 } );
+      shape.index( 0 );
+      shape.index( 1 );
+      shape.index( 2 );
       shape.endShape(CLOSE);
-      return shape;
    }
 
    PShape createGroup() {
@@ -902,6 +1246,12 @@ public:
    }
 
    PShape createEllipse(float x, float y, float width, float height) {
+      PShape shape = createShape();
+      buildEllipse(shape, x, y, width, height);
+      return shape;
+   }
+
+   void applyEllipseMode(float &x, float &y, float &width, float &height) const {
       switch (ellipse_mode) {
       case CENTER:
          break;
@@ -920,32 +1270,46 @@ public:
       default:
          abort();
       }
+   }
+
+   void ellipseOutline(float x, float y, float width, float height) {
+      int NUMBER_OF_VERTICES = circleSegments( {x,y}, std::max( width, height ) / 2.0F );
+      const auto &table = sinCosTable( NUMBER_OF_VERTICES );
+      outline.clear();
+      for(int i = 0; i < NUMBER_OF_VERTICES; ++i) {
+         outline.push_back( { x + width / 2.0F * table[i][0], y + height / 2.0F * table[i][1] } );
+      }
+   }
+
+   void buildEllipse(PShape &shape, float x, float y, float width, float height) {
+      applyEllipseMode(x, y, width, height);
       if (!_shape.isStroked() && !_shape.isTextureSet()) {
          // If there's no stroke and no texture use circle optimization here
-         PShape shape = drawUntexturedFilledEllipse( x, y, width, height, _shape.getFillColor(), PMatrix::Identity() );
-         return shape;
+         drawUntexturedFilledEllipse( shape, x, y, width, height, _shape.getFillColor(), PMatrix::Identity() );
       } else if (_shape.isStroked() && _shape.isFilled() &&
                  _shape.getFillColor() == _shape.getStrokeColor() && !_shape.isTextureSet()) {
-         PShape shape = drawUntexturedFilledEllipse( x, y, width + _shape.getStrokeWeight(), height + _shape.getStrokeWeight(),
-                                                     _shape.getFillColor(), PMatrix::Identity() );
-         return shape;
+         drawUntexturedFilledEllipse( shape, x, y, width + _shape.getStrokeWeight(), height + _shape.getStrokeWeight(),
+                                      _shape.getFillColor(), PMatrix::Identity() );
       } else {
-         int NUMBER_OF_VERTICES=32;
-         PShape shape = createShape();
+         ellipseOutline(x, y, width, height);
          shape.beginShape(CONVEX_POLYGON);
          shape.copyStyle( _shape );
-         shape.vertex( fast_ellipse_point( {x,y}, 0, width / 2.0F, height /2.0F) );
-         for(int i = 1; i < NUMBER_OF_VERTICES-1; ++i) {
-            shape.vertex( fast_ellipse_point( {x,y}, i, width / 2.0F, height /2.0F) );
+         for (auto &&p : outline) {
+            shape.vertex( p );
          }
-         shape.vertex( fast_ellipse_point( {x,y}, NUMBER_OF_VERTICES-1, width / 2.0F, height /2.0F) );
          shape.endShape(CLOSE);
-         return shape;
       }
    }
 
    PShape createArc(float x, float y, float width, float height, float start,
                     float stop, int ellipse_mode, int mode) {
+      PShape shape = createShape();
+      buildArc(shape, x, y, width, height, start, stop, ellipse_mode, mode);
+      return shape;
+   }
+
+   void buildArc(PShape &shape, float x, float y, float width, float height, float start,
+                 float stop, int ellipse_mode, int mode) {
 
       if (ellipse_mode != RADIUS) {
          width /=2;
@@ -975,7 +1339,6 @@ public:
 
       if (!_shape.isStroked() && !_shape.isTextureSet()) {
          // If there's no stroke and no texture use circle optimization here
-         PShape shape = createShape();
          shape.copyStyle( _shape );
          shape.circleTexture();
          shape.tint( shape.getFillColor() );
@@ -1016,12 +1379,10 @@ public:
                0.5F + pos.x/2.0F, 0.5F + pos.y/2.0F );
          }
          shape.endShape(strokeMode);
-         return shape;
       } else {
-         PShape shape = createShape();
          shape.beginShape(CONVEX_POLYGON);
          shape.copyStyle( _shape );
-         int NUMBER_OF_VERTICES=32;
+         int NUMBER_OF_VERTICES = circleSegments( {x,y}, std::max( width, height ) );
          if ( fillMode == PIE ) {
             shape.vertex(x,y);
          }
@@ -1030,17 +1391,20 @@ public:
          }
          shape.vertex( { x + width * sinf(-stop + HALF_PI), y + height * cosf(-stop + HALF_PI) } );
          shape.endShape(strokeMode);
-         return shape;
       }
    }
 
    PShape createPoint(float x, float y) {
       PShape shape = createShape();
+      buildPoint(shape, x, y);
+      return shape;
+   }
+
+   void buildPoint(PShape &shape, float x, float y) {
       shape.beginShape(POINTS);
       shape.copyStyle( _shape );
       shape.vertex(x,y);
       shape.endShape();
-      return shape;
    }
 
    void smooth(int aaFactor=2, int aaMode=MSAA) {
@@ -1083,6 +1447,7 @@ public:
          background(DEFAULT_GRAY);
      }
 
+      last_depth_sort_time = std::exchange(depth_sort_time, 0);
       return std::exchange(flushes, 0);
    }
 
@@ -1143,7 +1508,6 @@ unsigned int *PGraphics::getPixels() {
 
 PGraphics::PGraphics(int width, int height, int mode, int aaMode, int aaFactor)
    : impl(std::make_shared<PGraphicsImpl>(width, height, mode, aaMode, aaFactor)) {
-   graphicsHandles().push_back(impl);
 }
 
 gl::texture_t_ptr PGraphics::getAsTexture() {
@@ -1315,6 +1679,14 @@ void PGraphics::hint(int type){
    return impl->hint(type);
 }
 
+void PGraphics::textOutline(color c, float weight) {
+   return impl->textOutline(c, weight);
+}
+
+void PGraphics::noTextOutline() {
+   return impl->noTextOutline();
+}
+
 void PGraphics::text(const std::string &text, float x, float y, float twidth, float theight) {
    return impl->text(text,x,y,twidth,theight);
 }
@@ -1363,6 +1735,14 @@ void PGraphics::sphereDetail(float res){
    return impl->sphereDetail(res, res);
 }
 
+void PGraphics::circleDetail(int minSegments, int maxSegments){
+   return impl->circleDetail(minSegments, maxSegments);
+}
+
+float PGraphics::depthSortMillis() const{
+   return impl->depthSortMillis();
+}
+
 PShape PGraphics::createSphere( float radius ){
    return impl->createSphere(radius);
 }
@@ -1744,11 +2124,9 @@ void PGraphics::resetMatrix(){
 }
 
 static void PGraphics_releaseAllFrameBuffers() {
-   for (const auto &i : graphicsHandles()) {
-      if (auto p = i.lock()) {
-         p->releaseResources();
-      }
-   }
+   PGraphicsImpl::for_each( [](PGraphicsImpl &p) {
+      p.releaseResources();
+   } );
 }
 
 void PGraphics::init() {
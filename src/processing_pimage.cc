@@ -1,5 +1,6 @@
 #include <iostream>
 #include <filesystem>
+#include <cmath>
 
 #include <curl/curl.h>
 #include <fmt/core.h>
@@ -7,7 +8,9 @@
 #include <stb_image_write.h>
 
 #include "processing_pimage.h"
+#include "processing_pimage_filter.h"
 #include "processing_debug.h"
+#include "processing_registry.h"
 #include "processing_opengl_texture.h"
 
 #include "glad/glad.h"
@@ -38,7 +41,7 @@ int textureWrapMode = CLAMP;
 
 template <> struct fmt::formatter<PImageImpl>;
 
-class PImageImpl {
+class PImageImpl : public registered_t<PImageImpl> {
 public:
    int width = 0;
    int height = 0;
@@ -168,21 +171,10 @@ public:
          loadPixels();
       switch (x) {
       case GRAY:
-         for(int i = 0; i< width * height; ++i) {
-            unsigned int p = pixels[i];
-            unsigned int x = (red(p) + green(p) + blue(p)) / 3;
-            pixels[i] = color( x,x,x, alpha(p) );
-         }
+         filterGray( pixels, width, height );
          break;
       case THRESHOLD:
-         for(int i = 0; i< width * height; ++i) {
-            unsigned int p = pixels[i];
-            unsigned int x = (red(p) + green(p) + blue(p)) / 3;
-            if ( x > level )
-               pixels[i] = color( WHITE, alpha(p) );
-            else
-               pixels[i] = color( BLACK, alpha(p) );
-         }
+         filterThreshold( pixels, width, height, level );
          break;
       case BLUR:
          convolve( { { 1, 2, 1},
@@ -190,16 +182,19 @@ public:
                      { 1, 2, 1}} );
          break;
       case OPAQUE:
-         for(int i = 0; i< width * height; ++i) {
-            unsigned int p = pixels[i];
-            pixels[i] = color( red(p), green(p), blue(p), 255);
-         }
+         filterOpaque( pixels, width, height );
          break;
       case INVERT:
-         for(int i = 0; i< width * height; ++i) {
-            unsigned int p = pixels[i];
-            pixels[i] = color( 255-red(p), 255-green(p), 255-blue(p), alpha(p));;
-         }
+         filterInvert( pixels, width, height );
+         break;
+      case POSTERIZE:
+         filterPosterize( pixels, width, height, (int)std::round( level ) );
+         break;
+      case ERODE:
+         filterErode( pixels, width, height );
+         break;
+      case DILATE:
+         filterDilate( pixels, width, height );
          break;
       default:
          abort();
@@ -291,22 +286,14 @@ void PImage::setClean() {
    impl->setClean();
 }
 
-static std::vector<std::weak_ptr<PImageImpl>> &imageHandles() {
-   static std::vector<std::weak_ptr<PImageImpl>> handles;
-   return handles;
-}
-
 static void PImage_releaseAllTextures() {
-   for (auto i : imageHandles()) {
-      if (auto p = i.lock()) {
-         p->releaseTexture();
-      }
-   }
+   PImageImpl::for_each( [](PImageImpl &p) {
+      p.releaseTexture();
+   } );
 }
 
 PImage::PImage( std::shared_ptr<PImageImpl> impl_ ) {
    impl = impl_;
-   imageHandles().push_back( impl_ );
 }
 
 PImage::operator bool() const {
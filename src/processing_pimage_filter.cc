@@ -0,0 +1,313 @@
+#include "processing_pimage_filter.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <future>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILTER_X86 1
+#define FILTER_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif defined(_M_X64)
+#define FILTER_X86 1
+#define FILTER_TARGET(isa)
+#include <immintrin.h>
+#endif
+
+static constexpr uint32_t AlphaMask = 0xFF000000;
+static constexpr uint32_t ColorMask = 0x00FFFFFF;
+
+// Average of red, green and blue rounded down, as the float loops did.
+static uint32_t average(uint32_t p) {
+   return ((p & 0xFF) + ((p >> 8) & 0xFF) + ((p >> 16) & 0xFF)) / 3;
+}
+
+static void grayScalar(uint32_t *p, size_t n) {
+   for (size_t i = 0; i < n; ++i) {
+      uint32_t x = average( p[i] );
+      p[i] = x | x << 8 | x << 16 | (p[i] & AlphaMask);
+   }
+}
+
+static void thresholdScalar(uint32_t *p, size_t n, int threshold) {
+   for (size_t i = 0; i < n; ++i) {
+      p[i] = ((int)average( p[i] ) >= threshold ? ColorMask : 0) | (p[i] & AlphaMask);
+   }
+}
+
+static void opaqueScalar(uint32_t *p, size_t n) {
+   for (size_t i = 0; i < n; ++i) {
+      p[i] |= AlphaMask;
+   }
+}
+
+static void invertScalar(uint32_t *p, size_t n) {
+   for (size_t i = 0; i < n; ++i) {
+      p[i] ^= ColorMask;
+   }
+}
+
+#ifdef FILTER_X86
+
+// Four pixels at a time. Dividing the channel sum by three is a multiply
+// by 0xAAAB keeping bits 17 and up, exact for every sum up to 765, done
+// with a 16 bit high multiply as SSE2 has no 32 bit one.
+FILTER_TARGET("sse2") static __m128i averageSSE2(__m128i v) {
+   const __m128i byte = _mm_set1_epi32( 0xFF );
+   __m128i sum = _mm_add_epi32( _mm_and_si128( v, byte ),
+                                _mm_add_epi32( _mm_and_si128( _mm_srli_epi32( v, 8 ), byte ),
+                                               _mm_and_si128( _mm_srli_epi32( v, 16 ), byte ) ) );
+   return _mm_srli_epi32( _mm_mulhi_epu16( sum, _mm_set1_epi32( 0xAAAB ) ), 1 );
+}
+
+FILTER_TARGET("sse2") static void graySSE2(uint32_t *p, size_t n) {
+   const __m128i alpha = _mm_set1_epi32( (int)AlphaMask );
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128( (const __m128i *)(p + i) );
+      __m128i x = averageSSE2( v );
+      __m128i out = _mm_or_si128( _mm_or_si128( x, _mm_slli_epi32( x, 8 ) ),
+                                  _mm_or_si128( _mm_slli_epi32( x, 16 ), _mm_and_si128( v, alpha ) ) );
+      _mm_storeu_si128( (__m128i *)(p + i), out );
+   }
+   grayScalar( p + i, n - i );
+}
+
+FILTER_TARGET("sse2") static void thresholdSSE2(uint32_t *p, size_t n, int threshold) {
+   const __m128i alpha = _mm_set1_epi32( (int)AlphaMask );
+   const __m128i color = _mm_set1_epi32( ColorMask );
+   const __m128i below = _mm_set1_epi32( threshold - 1 );
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128( (const __m128i *)(p + i) );
+      __m128i white = _mm_cmpgt_epi32( averageSSE2( v ), below );
+      __m128i out = _mm_or_si128( _mm_and_si128( white, color ), _mm_and_si128( v, alpha ) );
+      _mm_storeu_si128( (__m128i *)(p + i), out );
+   }
+   thresholdScalar( p + i, n - i, threshold );
+}
+
+FILTER_TARGET("sse2") static void opaqueSSE2(uint32_t *p, size_t n) {
+   const __m128i alpha = _mm_set1_epi32( (int)AlphaMask );
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128( (const __m128i *)(p + i) );
+      _mm_storeu_si128( (__m128i *)(p + i), _mm_or_si128( v, alpha ) );
+   }
+   opaqueScalar( p + i, n - i );
+}
+
+FILTER_TARGET("sse2") static void invertSSE2(uint32_t *p, size_t n) {
+   const __m128i color = _mm_set1_epi32( ColorMask );
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128( (const __m128i *)(p + i) );
+      _mm_storeu_si128( (__m128i *)(p + i), _mm_xor_si128( v, color ) );
+   }
+   invertScalar( p + i, n - i );
+}
+
+// The same eight pixels at a time.
+FILTER_TARGET("avx2") static __m256i averageAVX2(__m256i v) {
+   const __m256i byte = _mm256_set1_epi32( 0xFF );
+   __m256i sum = _mm256_add_epi32( _mm256_and_si256( v, byte ),
+                                   _mm256_add_epi32( _mm256_and_si256( _mm256_srli_epi32( v, 8 ), byte ),
+                                                     _mm256_and_si256( _mm256_srli_epi32( v, 16 ), byte ) ) );
+   return _mm256_srli_epi32( _mm256_mulhi_epu16( sum, _mm256_set1_epi32( 0xAAAB ) ), 1 );
+}
+
+FILTER_TARGET("avx2") static void grayAVX2(uint32_t *p, size_t n) {
+   const __m256i alpha = _mm256_set1_epi32( (int)AlphaMask );
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256( (const __m256i *)(p + i) );
+      __m256i x = averageAVX2( v );
+      __m256i out = _mm256_or_si256( _mm256_or_si256( x, _mm256_slli_epi32( x, 8 ) ),
+                                     _mm256_or_si256( _mm256_slli_epi32( x, 16 ), _mm256_and_si256( v, alpha ) ) );
+      _mm256_storeu_si256( (__m256i *)(p + i), out );
+   }
+   grayScalar( p + i, n - i );
+}
+
+FILTER_TARGET("avx2") static void thresholdAVX2(uint32_t *p, size_t n, int threshold) {
+   const __m256i alpha = _mm256_set1_epi32( (int)AlphaMask );
+   const __m256i color = _mm256_set1_epi32( ColorMask );
+   const __m256i below = _mm256_set1_epi32( threshold - 1 );
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256( (const __m256i *)(p + i) );
+      __m256i white = _mm256_cmpgt_epi32( averageAVX2( v ), below );
+      __m256i out = _mm256_or_si256( _mm256_and_si256( white, color ), _mm256_and_si256( v, alpha ) );
+      _mm256_storeu_si256( (__m256i *)(p + i), out );
+   }
+   thresholdScalar( p + i, n - i, threshold );
+}
+
+FILTER_TARGET("avx2") static void opaqueAVX2(uint32_t *p, size_t n) {
+   const __m256i alpha = _mm256_set1_epi32( (int)AlphaMask );
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256( (const __m256i *)(p + i) );
+      _mm256_storeu_si256( (__m256i *)(p + i), _mm256_or_si256( v, alpha ) );
+   }
+   opaqueScalar( p + i, n - i );
+}
+
+FILTER_TARGET("avx2") static void invertAVX2(uint32_t *p, size_t n) {
+   const __m256i color = _mm256_set1_epi32( ColorMask );
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256( (const __m256i *)(p + i) );
+      _mm256_storeu_si256( (__m256i *)(p + i), _mm256_xor_si256( v, color ) );
+   }
+   invertScalar( p + i, n - i );
+}
+
+#endif
+
+struct filter_kernels_t {
+   const char *name;
+   void (*gray)(uint32_t *, size_t);
+   void (*threshold)(uint32_t *, size_t, int);
+   void (*opaque)(uint32_t *, size_t);
+   void (*invert)(uint32_t *, size_t);
+};
+
+static filter_kernels_t pickKernels() {
+#if defined(FILTER_X86) && defined(__GNUC__)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      return { "avx2", grayAVX2, thresholdAVX2, opaqueAVX2, invertAVX2 };
+   }
+   if (__builtin_cpu_supports("sse2")) {
+      return { "sse2", graySSE2, thresholdSSE2, opaqueSSE2, invertSSE2 };
+   }
+#elif defined(FILTER_X86)
+   // Every x64 CPU has SSE2.
+   return { "sse2", graySSE2, thresholdSSE2, opaqueSSE2, invertSSE2 };
+#endif
+   return { "scalar", grayScalar, thresholdScalar, opaqueScalar, invertScalar };
+}
+
+static const filter_kernels_t &kernels() {
+   static const filter_kernels_t picked = pickKernels();
+   return picked;
+}
+
+const char *filterKernels() {
+   return kernels().name;
+}
+
+// Calls f(first_row, end_row) for bands of rows, one per thread for images
+// big enough to be worth it.
+template <typename F>
+static void inBands(int width, int height, F &&f) {
+   constexpr size_t ParallelThreshold = 1 << 16;
+   int threads = (size_t)width * height < ParallelThreshold ? 1 :
+      std::clamp( (int)std::thread::hardware_concurrency(), 1, std::min( height, 16 ) );
+   if (threads == 1) {
+      f( 0, height );
+      return;
+   }
+   int band = (height + threads - 1) / threads;
+   std::vector<std::future<void>> jobs;
+   for (int t = 1; t < threads; ++t) {
+      int begin = std::min( t * band, height );
+      int end = std::min( begin + band, height );
+      jobs.push_back( std::async( std::launch::async, [&f, begin, end] { f( begin, end ); } ) );
+   }
+   f( 0, std::min( band, height ) );
+   for (auto &job : jobs) {
+      job.get();
+   }
+}
+
+void filterGray(uint32_t *pixels, int width, int height) {
+   auto gray = kernels().gray;
+   inBands( width, height, [&](int begin, int end) {
+      gray( pixels + (size_t)begin * width, (size_t)(end - begin) * width );
+   } );
+}
+
+void filterThreshold(uint32_t *pixels, int width, int height, float level) {
+   // Averages are whole numbers so above level means at least
+   // floor(level) + 1.
+   int threshold = std::clamp( std::floor( level ) + 1.0F, 0.0F, 766.0F );
+   auto kernel = kernels().threshold;
+   inBands( width, height, [&](int begin, int end) {
+      kernel( pixels + (size_t)begin * width, (size_t)(end - begin) * width, threshold );
+   } );
+}
+
+void filterOpaque(uint32_t *pixels, int width, int height) {
+   auto opaque = kernels().opaque;
+   inBands( width, height, [&](int begin, int end) {
+      opaque( pixels + (size_t)begin * width, (size_t)(end - begin) * width );
+   } );
+}
+
+void filterInvert(uint32_t *pixels, int width, int height) {
+   auto invert = kernels().invert;
+   inBands( width, height, [&](int begin, int end) {
+      invert( pixels + (size_t)begin * width, (size_t)(end - begin) * width );
+   } );
+}
+
+// Each channel value maps through a table, it doesn't vectorize without
+// a gather so it's only split across threads.
+void filterPosterize(uint32_t *pixels, int width, int height, int levels) {
+   levels = std::clamp( levels, 2, 255 );
+   std::array<uint32_t, 256> table;
+   for (int c = 0; c < 256; ++c) {
+      table[c] = ((c * levels) >> 8) * 255 / (levels - 1);
+   }
+   inBands( width, height, [&](int begin, int end) {
+      for (size_t i = (size_t)begin * width; i < (size_t)end * width; ++i) {
+         uint32_t p = pixels[i];
+         pixels[i] = table[p & 0xFF] | table[(p >> 8) & 0xFF] << 8 | table[(p >> 16) & 0xFF] << 16 | (p & AlphaMask);
+      }
+   } );
+}
+
+// Weighted luminance, only ever compared.
+static uint32_t luminance(uint32_t p) {
+   return 77 * (p & 0xFF) + 151 * ((p >> 8) & 0xFF) + 28 * ((p >> 16) & 0xFF);
+}
+
+// Reads from a copy so every pixel sees its neighbours' original values.
+// Edges use the pixel itself for the missing neighbour.
+template <typename Better>
+static void morphology(uint32_t *pixels, int width, int height, Better better) {
+   std::vector<uint32_t> source( pixels, pixels + (size_t)width * height );
+   inBands( width, height, [&](int begin, int end) {
+      for (int y = begin; y < end; ++y) {
+         const uint32_t *row = source.data() + (size_t)y * width;
+         const uint32_t *up = y > 0 ? row - width : row;
+         const uint32_t *down = y < height - 1 ? row + width : row;
+         uint32_t *out = pixels + (size_t)y * width;
+         for (int x = 0; x < width; ++x) {
+            uint32_t best = row[x];
+            uint32_t best_luminance = luminance( best );
+            for (uint32_t neighbour : { row[std::max( x - 1, 0 )], row[std::min( x + 1, width - 1 )], up[x], down[x] }) {
+               uint32_t l = luminance( neighbour );
+               if (better( l, best_luminance )) {
+                  best = neighbour;
+                  best_luminance = l;
+               }
+            }
+            out[x] = best;
+         }
+      }
+   } );
+}
+
+void filterErode(uint32_t *pixels, int width, int height) {
+   morphology( pixels, width, height, std::less<uint32_t>() );
+}
+
+void filterDilate(uint32_t *pixels, int width, int height) {
+   morphology( pixels, width, height, std::greater<uint32_t>() );
+}
@@ -1,5 +1,6 @@
 #include "processing_pshader.h"
 #include "processing_debug.h"
+#include "processing_registry.h"
 #include <vector>
 #include <map>
 #include <string>
@@ -40,6 +41,60 @@ static const char *flatFragmentShader = R"glsl(
       }
 )glsl";
 
+// Text drawn from signed distance field glyphs. The field is in the
+// texture's alpha with the outline at 0.5, the outline colour and width
+// in distance units ride along in the emissive and shininess attributes.
+static const char *sdfVertexShader = R"glsl(
+      #version 400
+      in vec3 position;
+      in vec4 color;
+      in vec2 texCoord;
+      in int tunit;
+      in int mindex;
+      in vec4 emissive;
+      in float shininess;
+      uniform mat4 PVmatrix;
+      uniform mat4 Mmatrix[16];
+      flat out int vertTindex;
+      out vec4 vertColor;
+      out vec2 vertTexCoord;
+      out vec4 outlineColor;
+      out float outlineWidth;
+
+      void main()
+      {
+          gl_Position = PVmatrix * Mmatrix[mindex] * vec4(position,1.0);
+          vertColor = color;
+          vertTexCoord = texCoord;
+          vertTindex = tunit;
+          outlineColor = vec4(emissive.rgb, color.a);
+          outlineWidth = shininess;
+      }
+)glsl";
+
+static const char *sdfFragmentShader = R"glsl(
+      #version 400
+      uniform sampler2D texture[16];
+      flat in int vertTindex;
+      in vec4 vertColor;
+      in vec2 vertTexCoord;
+      in vec4 outlineColor;
+      in float outlineWidth;
+      out vec4 fragColor;
+
+      void main()
+      {
+          float distance = texture2D(texture[vertTindex], vertTexCoord).a;
+          // Antialias over about a pixel whatever the scale.
+          float smoothing = 0.7 * fwidth(distance);
+          float fill = smoothstep(0.5 - smoothing, 0.5 + smoothing, distance);
+          float edge = 0.5 - outlineWidth;
+          float coverage = smoothstep(edge - smoothing, edge + smoothing, distance);
+          vec4 c = mix(outlineColor, vertColor, outlineWidth > 0.0 ? fill : 1.0);
+          fragColor = vec4(c.rgb, c.a * coverage);
+      }
+)glsl";
+
 static const char *defaultVertexShader = R"glsl(
       #version 400
       in int mindex;
@@ -217,7 +272,7 @@ static const char *defaultFragmentShader = R"glsl(
 
 )glsl";
 
-class PShaderImpl {
+class PShaderImpl : public registered_t<PShaderImpl> {
 
    std::map<std::string, gl::texture_t_ptr> uniformsSampler;
    gl::shader_t shader;
@@ -255,17 +310,10 @@ public:
 
 };
 
-static std::vector<std::weak_ptr<PShaderImpl>> &shaderHandles() {
-   static std::vector<std::weak_ptr<PShaderImpl>> handles;
-   return handles;
-}
-
 static void PShader_releaseAllShaders() {
-   for (const auto &i : shaderHandles()) {
-      if (auto p = i.lock()) {
-         p->releaseShaders();
-      }
-   }
+   PShaderImpl::for_each( [](PShaderImpl &p) {
+      p.releaseShaders();
+   } );
 }
 
 PShaderImpl::PShaderImpl(GLuint parent, const char *vertSource,
@@ -350,17 +398,14 @@ struct fmt::formatter<PShaderImpl> {
 
 PShader::PShader(GLuint parent, const char *vertSource, const char *fragSource)
    : impl( std::make_shared<PShaderImpl>(parent, vertSource, fragSource) ) {
-   shaderHandles().push_back( impl );
 }
 
 PShader::PShader(GLuint parent, const char *fragSource)
    : impl( std::make_shared<PShaderImpl>(parent, defaultVertexShader, fragSource) ) {
-   shaderHandles().push_back( impl );
 }
 
 PShader::PShader(GLuint parent)
    : impl( std::make_shared<PShaderImpl>(parent, defaultVertexShader, defaultFragmentShader) ) {
-   shaderHandles().push_back( impl );
 }
 
 const gl::shader_t &PShader::getShader() const {
@@ -414,6 +459,10 @@ PShader loadFlatShader() {
    return {0, flatVertexShader, flatFragmentShader };
 };
 
+PShader loadSDFShader() {
+   return {0, sdfVertexShader, sdfFragmentShader };
+}
+
 PShader loadShader() {
    return { 0, defaultVertexShader, defaultFragmentShader };
 }
@@ -4,25 +4,66 @@
 #include <vector>
 #include <tesselator_cpp.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
 
 #include "processing_color.h"
+#include "processing_cow_vector.h"
 #include "processing_enum.h"
 #include "processing_opengl.h"
 #include "processing_pimage.h"
+#include "processing_mapped_file.h"
 #include "processing_pmaterial.h"
+#include "processing_registry.h"
 
 #include "processing_debug.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
 #undef DEBUG_METHOD
 #define DEBUG_METHOD() do {} while (false)
 
 template <> struct fmt::formatter<PShapeImpl>;
 
-class PShapeImpl {
+class PShapeImpl;
+
+// Everything about a shape's compiled batch. A copy of a shape starts out
+// uncompiled and builds its own batch, sharing one would let patching
+// either copy rewrite the other's geometry.
+struct compiled_state_t {
+   bool compiled = false;
+   gl::batch_t_ptr batch;
+
+   // Where every shape in a compiled group landed in the batch, so that
+   // changes can be patched in place rather than rebuilding everything.
+   struct record_t {
+      uint64_t version;
+      uint64_t tree_version;
+      PMatrix transform;
+      bool palette;
+      std::vector<const PShapeImpl*> children;
+      std::vector<gl::batch_t::span_t> spans;
+   };
+   std::unordered_map<const PShapeImpl*, record_t> records;
+   std::unordered_set<const PShapeImpl*> animated;
+   bool patchable = false;
+   // Changed shapes are drawn into this then copied over their spans.
+   gl::batch_t_ptr scratch;
+
+   compiled_state_t() = default;
+   compiled_state_t(const compiled_state_t &) {}
+   compiled_state_t &operator=(const compiled_state_t &) = delete;
+};
+
+class PShapeImpl : public registered_t<PShapeImpl>, compiled_state_t {
    friend struct fmt::formatter<PShapeImpl>;
    friend struct std::hash<PShapeImpl>;
 
@@ -40,17 +81,36 @@ private:
    PVector n = { 0.0, 0.0, 0.0 };
 
    std::string id;
-   std::vector<int> contour;
-   std::vector<gl::vertex_t> vertices;
-   std::vector<PMaterial> materials;
-   std::vector<vInfoExtra> extras;
+   // Geometry is shared between copies until one of them changes it.
+   cow_vector_t<int> contour;
+   cow_vector_t<gl::vertex_t> vertices;
+   cow_vector_t<PMaterial> materials;
+   cow_vector_t<vInfoExtra> extras;
    std::vector<PShape> children;
-   std::vector<unsigned short> indices;
-
-   mutable bool dirty = true;
+   cow_vector_t<unsigned short> indices;
+
+   // version counts changes to this shape's geometry and style,
+   // matrix_version changes to its shape matrix alone and tree_version
+   // counts both as well as changes to any of its descendants. It is bumped
+   // up through every group the shape has been added to.
+   uint64_t version = 0;
+   uint64_t matrix_version = 0;
+   uint64_t tree_version = 0;
+
+   // Groups this shape has been added to. Not copied, a copy doesn't
+   // belong to any group until it's added to one.
+   struct parent_list_t : std::vector<PShapeImpl*> {
+      parent_list_t() = default;
+      parent_list_t(const parent_list_t &) : std::vector<PShapeImpl*>() {}
+      parent_list_t(parent_list_t &&) = default;
+      parent_list_t &operator=(const parent_list_t &) { return *this; }
+      parent_list_t &operator=(parent_list_t &&) = default;
+   };
+   parent_list_t parents;
 
    int type = OPEN;
    float tightness = 0.0F;
+   float curve_tolerance = CURVE_TOLERANCE;
    std::vector<PVector> curve_vertices;
    PMatrix shape_matrix = PMatrix::Identity();
 
@@ -77,8 +137,91 @@ private:
    style_t style;
 
    int kind = POLYGON;
-   bool compiled = false;
-   gl::batch_t_ptr batch;
+   // Compiled batches can be welded and reordered for the vertex caches,
+   // the layout then no longer matches the tree so they can't be patched.
+   bool optimize_mesh = false;
+   gl::mesh_stats_t mesh_stats;
+
+   // Axis aligned box around everything the shape draws, in the shape's own
+   // coordinates before its shape matrix is applied.
+   struct bounds_t {
+      glm::vec3 min{ std::numeric_limits<float>::max() };
+      glm::vec3 max{ std::numeric_limits<float>::lowest() };
+      bool unbounded = false;
+
+      bool empty() const {
+         return !unbounded && min.x > max.x;
+      }
+
+      void add(const glm::vec3 &p) {
+         min = glm::min(min, p);
+         max = glm::max(max, p);
+      }
+
+      void add(const bounds_t &b, const glm::mat4 &m) {
+         unbounded = unbounded || b.unbounded;
+         if (b.unbounded || b.empty()) {
+            return;
+         }
+         for (int i = 0; i < 8; ++i) {
+            glm::vec3 corner = b.corner(i);
+            add( glm::vec3( m * glm::vec4(corner, 1.0F) ) );
+         }
+      }
+
+      void pad(float d) {
+         if (!empty()) {
+            min = min - glm::vec3(d);
+            max = max + glm::vec3(d);
+         }
+      }
+
+      glm::vec3 corner(int i) const {
+         return { i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z };
+      }
+
+      // True if m takes the whole box outside one of the clip planes.
+      bool outside(const glm::mat4 &m) const {
+         if (unbounded) {
+            return false;
+         }
+         if (empty()) {
+            return true;
+         }
+         std::array<int,6> out{};
+         for (int i = 0; i < 8; ++i) {
+            glm::vec4 c = m * glm::vec4(corner(i), 1.0F);
+            out[0] += c.x < -c.w;
+            out[1] += c.x >  c.w;
+            out[2] += c.y < -c.w;
+            out[3] += c.y >  c.w;
+            out[4] += c.z < -c.w;
+            out[5] += c.z >  c.w;
+         }
+         return std::find(out.begin(), out.end(), 8) != out.end();
+      }
+   };
+   // Cached against tree_version so edits anywhere below invalidate it.
+   mutable bounds_t bounds_cache;
+   mutable uint64_t bounds_version = std::numeric_limits<uint64_t>::max();
+
+   // World matrix from the last flatten. Every matrix computed gets a new
+   // serial number so children can tell their parent's world matrix is
+   // unchanged without comparing it, only the root compares matrices.
+   mutable PMatrix world_parent;
+   mutable PMatrix world;
+   mutable uint64_t world_version = std::numeric_limits<uint64_t>::max();
+   mutable uint64_t world_parent_serial = 0;
+   mutable uint64_t world_serial = 0;
+   static inline std::atomic<uint64_t> next_world_serial = 1;
+
+   // Whether the last culled flatten found the shape outside the frustum,
+   // which holds while its world matrix, its bounds and the view and
+   // projection stay the same.
+   mutable PMatrix cull_view_projection;
+   mutable uint64_t cull_world_serial = 0;
+   mutable uint64_t cull_version = std::numeric_limits<uint64_t>::max();
+   mutable bool cull_outside = false;
 
 public:
 
@@ -90,12 +233,12 @@ public:
    }
 
    void enableStyle() {
-      dirty = true;
+      markDirty();
       useGlobalStyle = false;
    }
 
    void disableStyle() {
-      dirty = true;
+      markDirty();
       useGlobalStyle = true;
    }
 
@@ -120,19 +263,79 @@ public:
       std::swap(extras,other.extras);
       std::swap(children,other.children);
       std::swap(indices,other.indices);
-      std::swap(dirty,other.dirty);
+      std::swap(version,other.version);
+      std::swap(matrix_version,other.matrix_version);
+      std::swap(tree_version,other.tree_version);
+      std::swap(bounds_cache,other.bounds_cache);
+      std::swap(bounds_version,other.bounds_version);
+      std::swap(world_parent,other.world_parent);
+      std::swap(world,other.world);
+      std::swap(world_version,other.world_version);
+      std::swap(world_parent_serial,other.world_parent_serial);
+      std::swap(world_serial,other.world_serial);
+      std::swap(cull_view_projection,other.cull_view_projection);
+      std::swap(cull_world_serial,other.cull_world_serial);
+      std::swap(cull_version,other.cull_version);
+      std::swap(cull_outside,other.cull_outside);
       std::swap(type,other.type);
       std::swap(style,other.style);
       std::swap(tightness,other.tightness);
+      std::swap(curve_tolerance,other.curve_tolerance);
       std::swap(curve_vertices,other.curve_vertices);
       std::swap(shape_matrix,other.shape_matrix);
       std::swap(kind,other.kind);
       std::swap(width,other.width);
       std::swap(height,other.height);
       std::swap(useGlobalStyle,other.useGlobalStyle);
+      // Groups refer to shapes by address so parents stay put but the
+      // children we just swapped need to know who they belong to now.
+      other.relinkChildren(this);
+      relinkChildren(&other);
       return *this;
    }
 
+   void relinkChildren(const PShapeImpl *from) {
+      for (auto &&child : children) {
+         auto &p = child.impl->parents;
+         std::replace(p.begin(), p.end(), const_cast<PShapeImpl*>(from), this);
+      }
+   }
+
+   void unlinkChildren() {
+      for (auto &&child : children) {
+         auto &p = child.impl->parents;
+         auto i = std::find(p.begin(), p.end(), this);
+         if (i != p.end()) {
+            p.erase(i);
+         }
+      }
+   }
+
+   void adoptChildren() {
+      for (auto &&child : children) {
+         child.impl->parents.push_back(this);
+      }
+   }
+
+   void markDirty() {
+      ++version;
+      touch();
+   }
+
+   // Moving a shape leaves its geometry alone, compiled groups only need
+   // to update its transform.
+   void markMoved() {
+      ++matrix_version;
+      touch();
+   }
+
+   void touch() {
+      ++tree_version;
+      for (auto *parent : parents) {
+         parent->touch();
+      }
+   }
+
    void reserve(int v, int i) {
       DEBUG_METHOD();
       vertices.reserve(v);
@@ -141,10 +344,8 @@ public:
       indices.reserve(i);
    }
 
-   PShapeImpl() {
-      DEBUG_METHOD();
-      reserve(4,6);
-      style.currentMaterial = {
+   static PMaterial defaultMaterial() {
+      return {
          gl::color_t{1.0f,1.0f,1.0f,1.0f},
          gl::color_t{0.0f,0.0f,0.0f,1.0f},
          gl::color_t{0.0f,0.0f,0.0f,1.0f},
@@ -152,16 +353,44 @@ public:
          1.0, 1.0, 4, {} };
    }
 
+   PShapeImpl() {
+      DEBUG_METHOD();
+      reserve(4,6);
+      style.currentMaterial = defaultMaterial();
+   }
+
+   // Put the shape back into its freshly constructed state but hang on to
+   // the storage, so a scratch shape can be reused without allocating.
+   void reset() {
+      DEBUG_METHOD();
+      beginShape(POLYGON);
+      contour.clear();
+      curve_vertices.clear();
+      extraAttributes.clear();
+      useGlobalStyle = false;
+      setNormals = false;
+      n = { 0.0, 0.0, 0.0 };
+      type = OPEN;
+      tightness = 0.0F;
+      curve_tolerance = CURVE_TOLERANCE;
+      shape_matrix = PMatrix::Identity();
+      markMoved();
+      style = {};
+      style.currentMaterial = defaultMaterial();
+   }
+
    PShapeImpl(const PShapeImpl &copy) = default;
 
    ~PShapeImpl() {
       DEBUG_METHOD();
+      unlinkChildren();
    }
 
    void addChild( const PShape &shape ) {
       DEBUG_METHOD();
-      dirty=true;
       children.push_back( shape );
+      shape.impl->parents.push_back( this );
+      markDirty();
    }
 
    PShape getChild( int i ) {
@@ -206,19 +435,56 @@ public:
 
    void copyStyle( const PShapeImpl &other ) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style = other.style;
    }
 
+   // Give every existing vertex the style of other, as if the shape had
+   // been built with it, so a mesh can be reused rather than rebuilt.
+   void restyle( const PShapeImpl &other, float weight_scale ) {
+      DEBUG_METHOD();
+      copyStyle( other );
+      auto stroke = getStrokeColor();
+      for (size_t i = 0; i < vertices.size(); ++i) {
+         vertices[i].fill = style.gl_fill_color;
+         materials[i] = style.currentMaterial;
+         extras[i] = { stroke, style.stroke_weight * weight_scale };
+      }
+   }
+
+   // True if other's style draws exactly the same as this shape's.
+   bool sameStyle( const PShapeImpl &other ) const {
+      auto same = [](const std::optional<color> &x, const std::optional<color> &y) {
+         return x.has_value() == y.has_value() &&
+            (!x || (x->r == y->r && x->g == y->g && x->b == y->b && x->a == y->a));
+      };
+      const auto &a = style;
+      const auto &b = other.style;
+      const auto &ma = a.currentMaterial;
+      const auto &mb = b.currentMaterial;
+      return same( a.fill_color, b.fill_color ) && a.gl_fill_color == b.gl_fill_color &&
+         same( a.stroke_color, b.stroke_color ) && a.stroke_weight == b.stroke_weight &&
+         a.line_end_cap == b.line_end_cap &&
+         ma.ambientColor == mb.ambientColor && ma.specularColor == mb.specularColor &&
+         ma.emissiveColor == mb.emissiveColor && ma.specularExponent == mb.specularExponent &&
+         a.texture_ == b.texture_ && same( a.tint_color, b.tint_color ) && a.mode == b.mode &&
+         a.override_fill_color == b.override_fill_color &&
+         a.override_stroke_color == b.override_stroke_color &&
+         a.override_stroke_weight == b.override_stroke_weight;
+   }
+
    void clear() {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       vertices.clear();
       materials.clear();
       extras.clear();
       indices.clear();
+      unlinkChildren();
       children.clear();
-      batch = std::make_shared<gl::batch_t>();
+      compiled = false;
+      records.clear();
+      batch.reset();
    }
 
    void rotate(float angle, float x, float y, float z) {
@@ -268,25 +534,24 @@ public:
 
    void scale(float x) {
       DEBUG_METHOD();
-      dirty=true;
       scale(x,x,x);
    }
 
    void transform(const PMatrix &transform) {
       DEBUG_METHOD();
-      dirty=true;
+      markMoved();
       shape_matrix = shape_matrix * transform;
    }
 
    void resetMatrix() {
       DEBUG_METHOD();
-      dirty=true;
+      markMoved();
       shape_matrix = PMatrix::Identity();
    }
 
    void beginShape(int kind_ = POLYGON) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       // Supported types, POLYGON, POINTS, TRIANGLES, TRINALGE_STRIP, GROUP
       kind = kind_;
       clear();
@@ -294,7 +559,7 @@ public:
 
    void beginContour() {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       contour.push_back(vertices.size());
    }
 
@@ -304,7 +569,7 @@ public:
 
    void textureMode( int mode_ ) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.mode = mode_;
    }
 
@@ -315,7 +580,7 @@ public:
 
    void material(PMaterial &mat) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       noStroke();
       textureMode( NORMAL );
       if ( mat.texture )
@@ -325,39 +590,39 @@ public:
 
    void texture(PImage img) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.texture_ = img;
    }
 
    void circleTexture() {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.mode = NORMAL;
       style.texture_ = PImage::circle();
    }
 
    void noTexture() {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       style.texture_.reset();
    }
 
    void noNormal() {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       setNormals = false;
    }
 
    void normal(PVector p) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       setNormals = true;
       n = p;
    }
 
    void normal(float x, float y, float z) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       setNormals = true;
       n.x = x;
       n.y = y;
@@ -391,7 +656,7 @@ public:
 
    void vertex(PVector p, PVector2 t) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       if (style.texture_ && style.mode == IMAGE) {
          t.x /= style.texture_.value().width;
          t.y /= style.texture_.value().height;
@@ -403,7 +668,7 @@ public:
 
    void index(unsigned short i) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       indices.push_back(i);
    }
 
@@ -421,8 +686,10 @@ public:
       DEBUG_METHOD();
       float x1 = vertices.back().position.x;
       float y1 = vertices.back().position.y;
-      for (float t = 0.01; t <= 1; t += 0.01) {
+      int segments = bezierSegmentsCubic( {x1, y1}, {x2, y2}, {x3, y3}, {x4, y4}, curveTolerance() );
+      for (int i = 1; i <= segments; ++i) {
          // Compute the Bezier curve points
+         float t = (float)i / segments;
          float x = bezierPointCubic( x1, x2, x3, x4, t );
          float y = bezierPointCubic( y1, y2, y3, y4, t );
          vertex(x, y);
@@ -433,34 +700,42 @@ public:
       DEBUG_METHOD();
       float anchor1_x = vertices.back().position.x;
       float anchor1_y = vertices.back().position.y;
-      for (float t = 0.01; t <= 1; t += 0.01) {
+      int segments = bezierSegmentsQuadratic( {anchor1_x, anchor1_y}, {control.x, control.y}, {anchor2.x, anchor2.y}, curveTolerance() );
+      for (int i = 1; i <= segments; ++i) {
          // Compute the Bezier curve points
+         float t = (float)i / segments;
          float x = bezierPointQuadratic( anchor1_x, control.x, anchor2.x, t );
          float y = bezierPointQuadratic( anchor1_y, control.y, anchor2.y, t );
          vertex(x, y);
       }
    }
 
+   // Maximum distance, in pixels at the current scale, that flattened
+   // curves are allowed to stray from the true curve.
+   void setCurveTolerance(float tolerance) {
+      DEBUG_METHOD();
+      curve_tolerance = tolerance;
+   }
+
+   float curveTolerance() const {
+      return curve_tolerance / maxScale( shape_matrix );
+   }
+
    void curveTightness(float alpha) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       tightness = alpha;
    }
 
    void curveVertex(PVector c) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       curve_vertices.push_back(c);
    }
 
    void drawCurve() {
       DEBUG_METHOD();
-      constexpr int segments = 50;
-      constexpr float dt = (1.0 / segments);
-      constexpr float hdt = 0.5f * dt;
-      constexpr float hdt2x2 = 0.5f * 2.0f * dt * dt;
-      constexpr float hdt3x6 = 0.5f * 6.0f * dt * dt * dt;
-
+      float tolerance = curveTolerance();
       size_t size = curve_vertices.size();
       float s = tightness;
 
@@ -485,15 +760,14 @@ public:
          float zt1 = ( p0.z * (s-1) /*+ p1.z * 0 */   + p2.z * (1-s) /*+ p3.z * 0*/);
          float zt0 = ( p0.z * 0       + p1.z * 2      + p2.z * 0       + p3.z * 0);
 
-         PVector pos = p1; // {xt0, yt0, zt0};
-         PVector vel = PVector{xt1, yt1, zt1} * hdt;
-         PVector acc = PVector{xt2, yt2, zt2} * hdt2x2;
-         PVector jer = PVector{xt3, yt3, zt3} * hdt3x6;
-
-         // Just draw the control points
-         // vertex(p1);
+         // The span is half the cubic above, so its second derivative is
+         // 0.5 * (6 * t3 * t + 2 * t2) which peaks at one end or the other.
+         PVector c2 = {xt2, yt2, zt2};
+         PVector c3 = {xt3, yt3, zt3};
+         int segments = curveSegments( std::max( c2.mag(), (3 * c3 + c2).mag() ), tolerance );
+         float dt = 1.0F / segments;
 
-         for (int i = 0; i < segments - 1; ++i) {
+         for (int i = 0; i < segments; ++i) {
             // Use the full quadtraic queation
             float t1 = i * dt;
             float t2 = t1 * t1;
@@ -503,11 +777,6 @@ public:
                   yt3 * t3 + yt2 * t2 + yt1 * t1 + yt0,
                   zt3 * t3 + zt2 * t2 + zt1 * t1 + zt0
                });
-            // Use add differential in discrete steps
-            // vertex(pos);
-            // pos += vel;
-            // vel += acc;
-            // acc += jer;
          }
       }
    }
@@ -524,7 +793,7 @@ public:
 
    void endShape(int type_ = OPEN) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       // OPEN or CLOSE
       if (curve_vertices.size() > 0) {
          drawCurve();
@@ -566,13 +835,13 @@ public:
 
    void index( std::vector<unsigned short> &&i ) {
       DEBUG_METHOD();
-      dirty=true;
-      indices = i;
+      markDirty();
+      indices = std::move(i);
    }
 
    void specular(float r, float g, float b, float a) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       color specular_color = {r,g,b,a};
       auto gl_specular_color = flatten_color_mode( specular_color );
       style.currentMaterial.specularColor = gl_specular_color;
@@ -580,25 +849,25 @@ public:
 
    void shininess(float r) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.currentMaterial.specularExponent = r;
    }
 
    void ambient(float r, float g, float b) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.currentMaterial.ambientColor = flatten_color_mode( {r,g,b } );
    }
 
    void emissive(float r, float g, float b) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.currentMaterial.emissiveColor = flatten_color_mode( {r,g,b } );
    }
 
    void fill(float r,float g,  float b, float a) {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       style.fill_color = {r,g,b,a};
       style.gl_fill_color = flatten_color_mode( style.fill_color.value() );
       style.currentMaterial.ambientColor = style.gl_fill_color;
@@ -639,7 +908,7 @@ public:
 
    void stroke(float r,float g,  float b, float a) {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       style.stroke_color = {r,g,b,a};
    }
 
@@ -673,19 +942,19 @@ public:
 
    void strokeWeight(float x) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.stroke_weight = x;
    }
 
    void noStroke() {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       style.stroke_color.reset();
    }
 
    void noFill() {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       style.fill_color.reset();
    }
 
@@ -703,7 +972,7 @@ public:
 
    void tint(float r,float g,  float b, float a) {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       style.tint_color = {r,g,b,a};
       style.gl_fill_color = flatten_color_mode( style.tint_color );
       style.currentMaterial.ambientColor = style.gl_fill_color;
@@ -739,20 +1008,20 @@ public:
 
    void noTint() {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.tint_color = WHITE;
       style.gl_fill_color = flatten_color_mode( WHITE );
    }
 
    void strokeCap(int cap) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.line_end_cap = cap;
    }
 
    void setStroke(bool c) {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       for (auto &&child : children) {
          child.setStroke(c);
       }
@@ -761,7 +1030,7 @@ public:
 
    void setStroke(color c) {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       style.override_stroke_color = std::optional<color>(c);
       for (auto &&child : children) {
          child.setStroke(c);
@@ -770,7 +1039,7 @@ public:
 
    void setStrokeWeight(float w) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       style.override_stroke_weight = w;
       for (auto &&child : children) {
          child.setStrokeWeight(w);
@@ -779,7 +1048,7 @@ public:
 
    void setTexture( PImage img ) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       for (auto &&child : children) {
          child.setTexture(img);
       }
@@ -788,7 +1057,7 @@ public:
 
    void setFill(bool z) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       for (auto &&child : children) {
          child.setFill(z);
       }
@@ -805,7 +1074,7 @@ public:
 
    void setFill(color c) {
       DEBUG_METHOD();
-      dirty = true;
+      markDirty();
       for (auto &&child : children) {
          child.setFill(c);
       }
@@ -821,7 +1090,7 @@ public:
 
    void setTint(color c) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       for (auto &&child : children) {
          child.setFill(c);
       }
@@ -832,56 +1101,319 @@ public:
       }
    }
 
-   bool is_dirty() const {
-      DEBUG_METHOD();
-      if ( dirty ) {
+   void compile() {
+      compile(optimize_mesh);
+   }
+
+   void compile(bool optimize) {
+      if (optimize != optimize_mesh) {
+         optimize_mesh = optimize;
+         build();
+      } else if (!isCompiled() && !updateCompiled()) {
+         build();
+      }
+   }
+
+   const gl::mesh_stats_t &compileStats() const {
+      return mesh_stats;
+   }
+
+   // The shape's own matrix isn't baked into its compiled batch, it's
+   // applied when the batch is drawn so moving the whole shape is free.
+   void build() {
+      batch = std::make_shared<gl::batch_t>();
+      compiled = true;
+      patchable = true;
+      records.clear();
+      record(*this, PMatrix::Identity());
+      std::erase_if(animated, [&](auto shape) { return !records.contains(shape); });
+      if (optimize_mesh) {
+         mesh_stats = batch->optimize();
+         patchable = false;
+      }
+      batch->load();
+   }
+
+   bool isCompiled() const {
+      auto i = records.find(this);
+      return compiled && i != records.end() && tree_version == i->second.tree_version;
+   }
+
+   // Bring a compiled shape up to date by re-emitting only the parts of the
+   // tree that changed into their existing place in the batch. If anything
+   // changed layout the compiled batch is dropped and we return false, the
+   // shape is then drawn immediately until it is compiled again.
+   bool updateCompiled() {
+      if (!compiled) {
+         return false;
+      }
+      if (isCompiled()) {
          return true;
-      } else if ( kind == GROUP ) {
-         for (auto &&child : children) {
-            if (child.impl->is_dirty())
-               return true;
+      }
+      if (optimize_mesh) {
+         build();
+         return true;
+      }
+      bool rebuild = false;
+      if (patchable && patch(*this, PMatrix::Identity(), false, rebuild)) {
+         if (rebuild) {
+            build();
+         } else {
+            batch->loadPatches();
          }
+         return true;
       }
+      compiled = false;
+      records.clear();
       return false;
    }
 
-   void compile() {
-      if (!isCompiled()) {
-         batch = std::make_shared<gl::batch_t>();
+   gl::batch_t_ptr getBatch() {
+      return batch;
+   }
+
+   // Compiled shapes saved to disk start with this, followed by the batch.
+   struct compiled_header_t {
+      char magic[4] = { 'P', 'S', 'H', 'C' };
+      uint32_t version = 1;
+      uint32_t vertex_size = sizeof(gl::vertex_t);
+      uint32_t material_size = sizeof(gl::material_t);
+      uint64_t source_hash = 0;
+      std::array<float,16> shape_matrix;
+      float width = 0;
+      float height = 0;
+   };
+
+   void writeCompiled(std::ostream &out, uint64_t source_hash, float width, float height) {
+      compile();
+      compiled_header_t header;
+      header.source_hash = source_hash;
+      std::memcpy( header.shape_matrix.data(), glm::value_ptr( shape_matrix.glm_data() ), sizeof(header.shape_matrix) );
+      header.width = width;
+      header.height = height;
+      out.write( (const char *)&header, sizeof(header) );
+      batch->write( out );
+   }
+
+   // Turn this into a compiled shape with no children of its own, only a
+   // batch. It can be moved and drawn but not edited.
+   bool readCompiled(std::string_view data, uint64_t source_hash, float &width, float &height) {
+      compiled_header_t expected;
+      compiled_header_t header;
+      if (data.size() < sizeof(header)) {
+         return false;
+      }
+      std::memcpy( &header, data.data(), sizeof(header) );
+      if (std::memcmp( header.magic, expected.magic, sizeof(header.magic) ) != 0 ||
+          header.version != expected.version ||
+          header.vertex_size != expected.vertex_size ||
+          header.material_size != expected.material_size ||
+          (source_hash != 0 && header.source_hash != source_hash)) {
+         return false;
+      }
+      data.remove_prefix( sizeof(header) );
+      auto loaded = std::make_shared<gl::batch_t>();
+      if (!loaded->read( data )) {
+         return false;
+      }
+      beginShape( GROUP );
+      shape_matrix = glm::make_mat4( header.shape_matrix.data() );
+      markMoved();
+      width = header.width;
+      height = header.height;
+      batch = loaded;
+      batch->load();
+      compiled = true;
+      patchable = true;
+      records.clear();
+      records.emplace( this, record_t{ version, tree_version, PMatrix::Identity(), false, {}, {} } );
+      return true;
+   }
+
+   // A shape read from a compiled file is nothing but its batch, which is
+   // never patched, so a copy can draw from the same one.
+   void shareLoaded(const PShapeImpl &other) {
+      if (other.compiled && other.kind == GROUP && other.children.empty()) {
+         batch = other.batch;
          compiled = true;
-         flatten( batch, PMatrix::Identity(), true );
-         batch->load();
+         patchable = true;
+         records.emplace( this, record_t{ version, tree_version, PMatrix::Identity(), false, {}, {} } );
       }
    }
 
-   bool isCompiled() const {
-      return compiled && !is_dirty();
+   const bounds_t &bounds() const {
+      if (bounds_version == tree_version) {
+         return bounds_cache;
+      }
+      bounds_t b;
+      if ( kind == GROUP ) {
+         // Loaded from a compiled file, we only have the batch.
+         b.unbounded = children.empty() && compiled;
+         for (auto &&child : children) {
+            b.add( child.impl->bounds(), child.impl->shape_matrix.glm_data() );
+         }
+      } else {
+         for (auto &&v : vertices) {
+            b.add( v.position );
+         }
+         if ( isStroked() ) {
+            float weight = 0.0F;
+            for (auto &&e : extras) {
+               weight = std::max( weight, e.weight );
+            }
+            b.pad( style.override_stroke_weight.value_or(weight) / 2.0F );
+         }
+      }
+      bounds_cache = b;
+      bounds_version = tree_version;
+      return bounds_cache;
    }
 
-   gl::batch_t_ptr getBatch() {
-      return batch;
+   // clip takes the parent's coordinates to clip space.
+   bool outsideFrustum(const PMatrix &clip) const {
+      return bounds().outside( (clip * shape_matrix).glm_data() );
    }
 
-   void flatten(gl::batch_t_ptr batch, const PMatrix& transform, bool flatten_transforms) const {
+   // Like outsideFrustum() but from the world matrix worldMatrix() last
+   // returned, so a shape that hasn't moved only compares view_projection.
+   bool culled(const PMatrix &view_projection) const {
+      if (cull_world_serial != world_serial || cull_version != tree_version ||
+          !(cull_view_projection == view_projection)) {
+         cull_outside = bounds().outside( (view_projection * world).glm_data() );
+         cull_view_projection = view_projection;
+         cull_world_serial = world_serial;
+         cull_version = tree_version;
+      }
+      return cull_outside;
+   }
+
+   // parent_serial is the serial of transform when it is a parent's cached
+   // world matrix, zero when it came from somewhere else.
+   const PMatrix &worldMatrix(const PMatrix &transform, uint64_t parent_serial) const {
+      bool valid = world_version == matrix_version &&
+         (parent_serial ? parent_serial == world_parent_serial : transform == world_parent);
+      if (!valid) {
+         world_parent = transform;
+         world = transform * shape_matrix;
+         world_version = matrix_version;
+         world_serial = next_world_serial++;
+      }
+      world_parent_serial = parent_serial;
+      return world;
+   }
+
+   void flatten(gl::batch_t_ptr batch, const PMatrix& transform, bool flatten_transforms, const PMatrix *view_projection = nullptr) const {
       DEBUG_METHOD();
-      auto currentTransform = transform * shape_matrix;
+      flatten(batch, transform, 0, flatten_transforms, view_projection);
+   }
+
+   void flatten(gl::batch_t_ptr batch, const PMatrix& transform, uint64_t parent_serial, bool flatten_transforms, const PMatrix *view_projection) const {
+      const PMatrix &currentTransform = worldMatrix( transform, parent_serial );
+      if ( view_projection && culled( *view_projection ) ) {
+         return;
+      }
       if ( kind == GROUP ) {
          for (auto &&child : children) {
-            child.flatten(batch, currentTransform, flatten_transforms);
+            child.impl->flatten(batch, currentTransform, world_serial, flatten_transforms, view_projection);
+         }
+      } else {
+         draw(batch, currentTransform, flatten_transforms);
+      }
+   }
+
+   void draw(gl::batch_t_ptr batch, const PMatrix& transform, bool flatten_transforms) const {
+      if ( isFilled() )
+         draw_fill(batch, transform, flatten_transforms);
+      // draw_normals(batch, transform, flatten_transforms);
+      if ( isStroked() )
+         draw_stroke(batch, transform, flatten_transforms);
+   }
+
+   PMatrix compiledTransform(const PShapeImpl &shape, const PMatrix& transform) const {
+      return &shape == this ? transform : transform * shape.shape_matrix;
+   }
+
+   // Flatten the tree into batch noting where each shape ends up. Shapes
+   // that have previously only moved get their own entry in the transform
+   // palette, everything else has its transform baked into the vertices.
+   void record(const PShapeImpl &shape, const PMatrix& transform) {
+      auto currentTransform = compiledTransform(shape, transform);
+      bool palette = animated.contains(&shape);
+      auto [ i, inserted ] = records.try_emplace( &shape,
+         record_t{ shape.version, shape.tree_version, currentTransform, palette, {}, {} } );
+      // The same shape appearing twice can't be patched by address.
+      if (!inserted) {
+         patchable = false;
+      }
+      auto &r = i->second;
+      if ( shape.kind == GROUP ) {
+         for (auto &&child : shape.children) {
+            r.children.push_back( child.impl.get() );
+            record( *child.impl, currentTransform );
          }
       } else {
-         if ( isFilled() )
-            draw_fill(batch, currentTransform, flatten_transforms);
-         // draw_normals(batch, currentTransform, flatten_transforms);
-         if ( isStroked() )
-            draw_stroke(batch, currentTransform, flatten_transforms);
+         auto from = batch->mark();
+         if (palette) {
+            batch->transform( currentTransform.glm_data() );
+         }
+         shape.draw(batch, currentTransform, !palette);
+         r.spans = batch->spans(from);
       }
-      dirty = false;
+   }
+
+   bool patch(const PShapeImpl &shape, const PMatrix& transform, bool force, bool &rebuild) {
+      auto i = records.find(&shape);
+      if (i == records.end()) {
+         return false;
+      }
+      auto &r = i->second;
+      if (!force && shape.tree_version == r.tree_version) {
+         return true;
+      }
+      // A changed version means new geometry, anything else that changed
+      // on this shape was only its matrix.
+      auto currentTransform = compiledTransform(shape, transform);
+      bool moved = !(currentTransform == r.transform);
+      if (shape.version != r.version) {
+         force = true;
+      }
+      if ( shape.kind == GROUP ) {
+         if (shape.children.size() != r.children.size()) {
+            return false;
+         }
+         for (size_t j = 0; j < shape.children.size(); ++j) {
+            if (shape.children[j].impl.get() != r.children[j] ||
+                !patch(*shape.children[j].impl, currentTransform, force, rebuild)) {
+               return false;
+            }
+         }
+      } else if (force) {
+         if (!scratch) {
+            scratch = std::make_shared<gl::batch_t>();
+         }
+         scratch->rewind();
+         shape.draw(scratch, currentTransform, !r.palette);
+         if (!batch->patch(r.spans, *scratch)) {
+            return false;
+         }
+      } else if (moved && !r.palette) {
+         // Only moved, give it a palette entry so next time it's free.
+         animated.insert(&shape);
+         rebuild = true;
+      }
+      if (moved && r.palette) {
+         batch->transform( r.spans, currentTransform.glm_data() );
+      }
+      r.version = shape.version;
+      r.tree_version = shape.tree_version;
+      r.transform = currentTransform;
+      return true;
    }
 
    void draw_normals(gl::batch_t_ptr batch, const PMatrix& transform, bool flatten_transforms) const;
    void draw_stroke(gl::batch_t_ptr batchr, const PMatrix& transform, bool flatten_transforms) const;
    void draw_fill(gl::batch_t_ptr batch, const PMatrix& transform, bool flatten_transforms) const;
+   void draw_convex(gl::batch_t_ptr batch, const PMatrix& transform, const std::vector<PVector> &points, std::optional<PVector> normal) const;
 
    int getChildCount() const {
       DEBUG_METHOD();
@@ -900,13 +1432,13 @@ public:
 
    void setVertex(int i, PVector v) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       vertices[i].position = v;
    }
 
    void setVertex(int i, float x, float y , float z = 0) {
       DEBUG_METHOD();
-      dirty=true;
+      markDirty();
       vertices[i].position = {x,y,z};
    }
 
@@ -1091,7 +1623,7 @@ void PShapeImpl::populateIndices() {
 
    if ( !isFilled() ) return;
 
-   dirty=true;
+   markDirty();
 
    if (kind == QUADS || kind == QUAD) {
       if (vertices.size() % 4 != 0) abort();
@@ -1182,44 +1714,11 @@ void PShapeImpl::populateIndices() {
    }
 }
 
-const constexpr float xsincos[32][2] = {
-   { 1.000000, -0.000000 },
-   { 0.980785, 0.195090 },
-   { 0.923880, 0.382683 },
-   { 0.831470, 0.555570 },
-   { 0.707107, 0.707107 },
-   { 0.555570, 0.831470 },
-   { 0.382683, 0.923880 },
-   { 0.195090, 0.980785 },
-   { 0.000000, 1.000000 },
-   { -0.195090, 0.980785 },
-   { -0.382683, 0.923880 },
-   { -0.555570, 0.831470 },
-   { -0.707107, 0.707107 },
-   { -0.831470, 0.555570 },
-   { -0.923880, 0.382683 },
-   { -0.980785, 0.195090 },
-   { -1.000000, -0.000000 },
-   { -0.980785, -0.195090 },
-   { -0.923880, -0.382683 },
-   { -0.831470, -0.555570 },
-   { -0.707107, -0.707107 },
-   { -0.555570, -0.831470 },
-   { -0.382683, -0.923880 },
-   { -0.195091, -0.980785 },
-   { -0.000000, -1.000000 },
-   { 0.195090, -0.980785 },
-   { 0.382683, -0.923880 },
-   { 0.555570, -0.831470 },
-   { 0.707107, -0.707107 },
-   { 0.831469, -0.555570 },
-   { 0.923880, -0.382684 },
-   { 0.980785, -0.195090 } };
-
 PVector fast_ellipse_point(const PVector &center, int index, float xradius, float yradius) {
+   static const auto &table = sinCosTable(32);
    return {
-      center.x + xradius * xsincos[index][0],
-      center.y + yradius * xsincos[index][1],
+      center.x + xradius * table[index][0],
+      center.y + yradius * table[index][1],
       center.z };
 }
 
@@ -1240,15 +1739,26 @@ PLine drawLineMitred(PVector p1, PVector p2, PVector p3, float half_weight) {
    return { p2 + bisect * w, p2 - bisect * w };
 }
 
-PShapeImpl drawLinePoly(int points, const gl::vertex_t *p, const PShapeImpl::vInfoExtra *extras, bool closed, const PMatrix &transform,
-                        std::optional<color> override_color, std::optional<float> override_weight)  {
+// Scratch shape that stroke geometry is built in before being emitted,
+// kept with the batch so drawing strokes doesn't allocate a new shape
+// every time.
+static PShapeImpl &strokeShape(gl::batch_t &batch) {
+   auto &shape = batch.scratch.stroke;
+   if (!shape) {
+      shape = std::make_shared<PShapeImpl>();
+   }
+   shape->reset();
+   return *shape;
+}
+
+PShapeImpl &drawLinePoly(PShapeImpl &triangle_strip, int points, const gl::vertex_t *p, const PShapeImpl::vInfoExtra *extras, bool closed, const PMatrix &transform,
+                         std::optional<color> override_color, std::optional<float> override_weight)  {
    PLine start;
    PLine end;
 
    if ( points < 3 )
       abort();
 
-   PShapeImpl triangle_strip;
    triangle_strip.beginShape(TRIANGLE_STRIP_NOSTROKE);
    triangle_strip.transform( transform );
    triangle_strip.noStroke();
@@ -1293,9 +1803,8 @@ PShapeImpl drawLinePoly(int points, const gl::vertex_t *p, const PShapeImpl::vIn
    return triangle_strip;
 }
 
-PShapeImpl drawRoundLine(PVector p1, PVector p2, float weight1, float weight2, color color1, color color2, const PMatrix &transform ) {
+PShapeImpl &drawRoundLine(PShapeImpl &shape, PVector p1, PVector p2, float weight1, float weight2, color color1, color color2, const PMatrix &transform ) {
 
-   PShapeImpl shape;
 
    int NUMBER_OF_VERTICES=16;
 
@@ -1328,9 +1837,8 @@ PShapeImpl drawRoundLine(PVector p1, PVector p2, float weight1, float weight2, c
    return shape;
 }
 
-PShapeImpl drawLine(PVector p1, PVector p2, float weight1, float weight2, color color1, color color2, const PMatrix &transform ) {
+PShapeImpl &drawLine(PShapeImpl &shape, PVector p1, PVector p2, float weight1, float weight2, color color1, color color2, const PMatrix &transform ) {
 
-   PShapeImpl shape;
    shape.beginShape(CONVEX_POLYGON);
    shape.transform( transform );
    PVector normal1 = (p2 - p1).normal();
@@ -1360,9 +1868,8 @@ PShapeImpl drawLine(PVector p1, PVector p2, float weight1, float weight2, color
    return shape;
 }
 
-PShapeImpl drawCappedLine(PVector p1, PVector p2, float weight1, float weight2, color color1, color color2, const PMatrix &transform ) {
+PShapeImpl &drawCappedLine(PShapeImpl &shape, PVector p1, PVector p2, float weight1, float weight2, color color1, color color2, const PMatrix &transform ) {
 
-   PShapeImpl shape;
    shape.beginShape(CONVEX_POLYGON);
    shape.transform( transform );
    PVector normal1 = (p2 - p1).normal();
@@ -1399,8 +1906,7 @@ PShapeImpl drawCappedLine(PVector p1, PVector p2, float weight1, float weight2,
    return shape;
 }
 
-PShape drawUntexturedFilledEllipse(float x, float y, float width, float height, color color, const PMatrix &transform) {
-   PShape shape = createShape();;
+PShapeImpl &drawUntexturedFilledEllipse(PShapeImpl &shape, float x, float y, float width, float height, color color, const PMatrix &transform) {
    shape.beginShape(TRIANGLES);
    shape.circleTexture();
    shape.noStroke();
@@ -1412,11 +1918,23 @@ PShape drawUntexturedFilledEllipse(float x, float y, float width, float height,
    shape.vertex(x+width,y,1.0F,0);
    shape.vertex(x+width,y+height,1.0F,1.0F);
    shape.vertex(x,y+height,0,1.0F);
-   shape.index( { 0,2,1,0,3,2 } );
+   for (unsigned short i : { 0,2,1,0,3,2 }) {
+      shape.index(i);
+   }
    shape.endShape(CLOSE);
    return shape;
 }
 
+void drawUntexturedFilledEllipse(PShape &shape, float x, float y, float width, float height, color color, const PMatrix &transform) {
+   drawUntexturedFilledEllipse(*shape.impl, x, y, width, height, color, transform);
+}
+
+PShape drawUntexturedFilledEllipse(float x, float y, float width, float height, color color, const PMatrix &transform) {
+   PShape shape = createShape();
+   drawUntexturedFilledEllipse(shape, x, y, width, height, color, transform);
+   return shape;
+}
+
 void _line(PShapeImpl &triangles, PVector p1, PVector p2, float weight1, float weight2, color color1, color color2 ) {
 
    PVector normal1 = (p2 - p1).normal();
@@ -1449,8 +1967,7 @@ void _line(PShapeImpl &triangles, PVector p1, PVector p2, float weight1, float w
    triangles.index( i + 3 );
 }
 
-PShapeImpl drawTriangleNormal(const gl::vertex_t &p0, const gl::vertex_t &p1, const gl::vertex_t &p2, const PMatrix &transform) {
-   PShapeImpl shape;
+PShapeImpl &drawTriangleNormal(PShapeImpl &shape, const gl::vertex_t &p0, const gl::vertex_t &p1, const gl::vertex_t &p2, const PMatrix &transform) {
    shape.beginShape(TRIANGLES);
    shape.fill(RED);
    shape.transform( transform );
@@ -1477,7 +1994,7 @@ void PShapeImpl::draw_normals(gl::batch_t_ptr batch, const PMatrix &transform, b
    case TRIANGLE_FAN:
       // All of these should have just been flattened to triangles
       for (int i = 0; i < indices.size(); i+=3 ) {
-         drawTriangleNormal( vertices[indices[i]],vertices[indices[i+1]], vertices[indices[i+2]],
+         drawTriangleNormal( strokeShape(*batch), vertices[indices[i]],vertices[indices[i+1]], vertices[indices[i+2]],
                              shape_matrix).draw_fill( batch, transform, flatten_transforms );
       }
       break;
@@ -1498,7 +2015,7 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
    case POINTS:
    {
       for (int i = 0; i< vertices.size() ; ++i ) {
-         drawUntexturedFilledEllipse(
+         drawUntexturedFilledEllipse( strokeShape(*batch),
             vertices[i].position.x, vertices[i].position.y,
             override_weight.value_or(extras[i].weight), override_weight.value_or(extras[i].weight),
             override_color.value_or(extras[i].stroke), shape_matrix ).draw_fill( batch, transform, flatten_transforms );
@@ -1511,7 +2028,7 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
    case TRIANGLES:
    {
       // TODO: Fix mitred lines to somehow work in 3D
-      PShapeImpl shape;
+      auto &shape = strokeShape(*batch);
       shape.reserve(4*vertices.size(), 6 * vertices.size());
       shape.beginShape(TRIANGLES_NOSTROKE);
       for (int i = 0; i < indices.size(); i+=3 ) {
@@ -1536,7 +2053,7 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
    case LINES:
    {
       // TODO: Fix mitred lines to somehow work in 3D
-      PShapeImpl shape;
+      auto &shape = strokeShape(*batch);
       shape.reserve(2*vertices.size(), 3 * vertices.size());
       shape.beginShape(TRIANGLES_NOSTROKE);
       for (int i = 0; i < vertices.size(); i+=2 ) {
@@ -1557,18 +2074,18 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
    {
       if (vertices.size() > 2 ) {
          if (type == OPEN_SKIP_FIRST_VERTEX_FOR_STROKE) {
-            drawLinePoly( vertices.size() - 1, vertices.data() + 1, extras.data()+1, false, shape_matrix, override_color, override_weight ).draw_fill( batch, transform, flatten_transforms);
+            drawLinePoly( strokeShape(*batch), vertices.size() - 1, vertices.data() + 1, extras.data()+1, false, shape_matrix, override_color, override_weight ).draw_fill( batch, transform, flatten_transforms);
          } else {
             if ( contour.empty() ) {
-               drawLinePoly( vertices.size(), vertices.data(), extras.data(), type == CLOSE, shape_matrix, override_color, override_weight ).draw_fill( batch, transform, flatten_transforms);
+               drawLinePoly( strokeShape(*batch), vertices.size(), vertices.data(), extras.data(), type == CLOSE, shape_matrix, override_color, override_weight ).draw_fill( batch, transform, flatten_transforms);
             } else {
                if (contour[0] != 0) {
-                  drawLinePoly( contour[0], vertices.data(), extras.data(), type == CLOSE, shape_matrix, override_color, override_weight ).draw_fill( batch, transform, flatten_transforms);
+                  drawLinePoly( strokeShape(*batch), contour[0], vertices.data(), extras.data(), type == CLOSE, shape_matrix, override_color, override_weight ).draw_fill( batch, transform, flatten_transforms);
                }
                auto q = contour;
                q.push_back(vertices.size());
                for ( int i = 0; i < q.size() - 1; ++i ) {
-                  drawLinePoly( q[i+1] - q[i],
+                  drawLinePoly( strokeShape(*batch), q[i+1] - q[i],
                                 vertices.data() + q[i],
                                 extras.data() + q[i],
                                 type == CLOSE, shape_matrix, override_color, override_weight ).draw_fill( batch, transform, flatten_transforms);
@@ -1578,17 +2095,17 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
       } else if (vertices.size() == 2) {
          switch(style.line_end_cap) {
          case ROUND:
-            drawRoundLine( vertices[0].position, vertices[1].position,
+            drawRoundLine( strokeShape(*batch), vertices[0].position, vertices[1].position,
                            override_weight.value_or(extras[0].weight), override_weight.value_or(extras[1].weight),
                            override_color.value_or(extras[0].stroke), override_color.value_or(extras[1].stroke), shape_matrix ).draw_fill( batch, transform, flatten_transforms );
             break;
          case PROJECT:
-            drawCappedLine( vertices[0].position, vertices[1].position,
+            drawCappedLine( strokeShape(*batch), vertices[0].position, vertices[1].position,
                             override_weight.value_or(extras[0].weight), override_weight.value_or(extras[1].weight),
                             override_color.value_or(extras[0].stroke), override_color.value_or(extras[1].stroke), shape_matrix ).draw_fill( batch, transform, flatten_transforms );
             break;
          case SQUARE:
-            drawLine( vertices[0].position, vertices[1].position,
+            drawLine( strokeShape(*batch), vertices[0].position, vertices[1].position,
                       override_weight.value_or(extras[0].weight), override_weight.value_or(extras[1].weight),
                       override_color.value_or(extras[0].stroke), override_color.value_or(extras[1].stroke), shape_matrix ).draw_fill( batch, transform, flatten_transforms );
             break;
@@ -1596,7 +2113,7 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
             abort();
          }
       } else if (vertices.size() == 1) {
-         drawUntexturedFilledEllipse(
+         drawUntexturedFilledEllipse( strokeShape(*batch),
             vertices[0].position.x, vertices[0].position.y,
             override_weight.value_or(extras[0].weight), override_weight.value_or(extras[0].weight),
             override_color.value_or(extras[0].stroke), shape_matrix ).draw_fill( batch, transform, flatten_transforms );
@@ -1607,7 +2124,7 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
    case QUADS:
    {
       // TODO: Fix mitred lines to somehow work in 3D
-      PShapeImpl shape;
+      auto &shape = strokeShape(*batch);
       shape.reserve(4*vertices.size(), 6 * vertices.size());
       shape.beginShape(TRIANGLES_NOSTROKE);
       for (int i = 0; i < vertices.size(); i+=4 ) {
@@ -1636,7 +2153,7 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
    case QUAD_STRIP:
    {
       // TODO: Fix mitred lines to somehow work in 3D
-      PShapeImpl shape;
+      auto &shape = strokeShape(*batch);
       shape.reserve(4*vertices.size(), 6 * vertices.size());
       shape.beginShape(TRIANGLES_NOSTROKE);
       for (int i = 0; i < vertices.size()-2; i+=2 ) {
@@ -1664,7 +2181,7 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
    }
    case TRIANGLE_STRIP:
    {
-      PShapeImpl triangles;
+      auto &triangles = strokeShape(*batch);
       triangles.beginShape(TRIANGLES_NOSTROKE);
       triangles.transform( shape_matrix );
       _line(triangles,
@@ -1692,7 +2209,7 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
    case TRIANGLE_FAN:
    {
       // TODO: Proper 3D miters for triangle fan edges
-      PShapeImpl shape;
+      auto &shape = strokeShape(*batch);
       int n = vertices.size();
       if (n < 3) break;
 
@@ -1730,8 +2247,8 @@ void PShapeImpl::draw_stroke(gl::batch_t_ptr batch, const PMatrix& transform, bo
 void PShapeImpl::draw_fill(gl::batch_t_ptr batch, const PMatrix& transform_, bool flatten_transforms) const {
    DEBUG_METHOD();
    if (vertices.size() > 2 && kind != POINTS && kind != LINES) {
-      std::vector<gl::material_t> m;
-      m.reserve( materials.size() );
+      auto &m = batch->scratch.materials;
+      m.clear();
       for (const auto &material : materials ) {
          m.emplace_back(
             material.ambientColor,
@@ -1745,47 +2262,55 @@ void PShapeImpl::draw_fill(gl::batch_t_ptr batch, const PMatrix& transform_, boo
    }
 }
 
-static std::vector<std::weak_ptr<PShapeImpl>> &shapeHandles() {
-   static std::vector<std::weak_ptr<PShapeImpl>> handles;
-   return handles;
+// Emit a closed convex polygon in this shape's style, filled and stroked
+// exactly as a CONVEX_POLYGON built from points would be, without building
+// it first. Without a normal every vertex gets the face normal. Textured
+// styles aren't handled, callers build a shape for those.
+void PShapeImpl::draw_convex(gl::batch_t_ptr batch, const PMatrix& transform, const std::vector<PVector> &points, std::optional<PVector> normal) const {
+   DEBUG_METHOD();
+   if (!normal) {
+      normal = (points[1] - points[0]).cross(points[2] - points[0]).normalize();
+   }
+   auto &v = batch->scratch.vertices;
+   v.clear();
+   for (auto &&p : points) {
+      v.push_back( { p, *normal, { 0.0F, 0.0F }, style.gl_fill_color, 0, 0 } );
+   }
+   if ( isFilled() ) {
+      auto &m = batch->scratch.materials;
+      m.assign( points.size(), { style.currentMaterial.ambientColor, style.currentMaterial.specularColor,
+                                 style.currentMaterial.emissiveColor, style.currentMaterial.specularExponent } );
+      auto &i = batch->scratch.indices;
+      i.clear();
+      for (size_t k = 1; k + 1 < points.size(); ++k) {
+         i.insert( i.end(), { 0, (unsigned short)k, (unsigned short)(k + 1) } );
+      }
+      std::optional<gl::color_t> override = style.override_fill_color ? flatten_color_mode(style.override_fill_color.value()) : std::optional<gl::color_t>();
+      batch->vertices( v, m, i, transform.glm_data(), false, {}, override );
+   }
+   if ( isStroked() ) {
+      std::optional<color> override_color = style.override_stroke_color ? style.override_stroke_color.value() : std::optional<color>();
+      vInfoExtra extra{ getStrokeColor(), style.stroke_weight };
+      drawLinePoly( strokeShape(*batch), v.size(), v.data(), &extra, true, PMatrix::Identity(),
+                    override_color, style.override_stroke_weight ).draw_fill( batch, transform, false );
+   }
 }
 
 static void PShape_releaseAllVAOs() {
-   for (const auto &i : shapeHandles()) {
-      if (auto p = i.lock()) {
-         p->clear();
-      }
-   }
+   PShapeImpl::for_each( [](PShapeImpl &p) {
+      p.clear();
+   } );
 }
 
 void PShape::init() {
 }
 
 void PShape::optimize() {
-   PShape::gc();
-   auto &handles = shapeHandles();
-   for (const auto &i : handles) {
-      if (auto p = i.lock()) {
-         if (p->getChildCount() > 0) {
-            p->compile();
-         }
+   PShapeImpl::for_each( [](PShapeImpl &p) {
+      if (p.getChildCount() > 0) {
+         p.compile();
       }
-   }
-}
-
-void PShape::gc() {
-   static std::size_t lastSize = 0;
-   auto &oldHandles = shapeHandles();
-   if (oldHandles.size() > lastSize + 200 ) {
-      std::vector<std::weak_ptr<PShapeImpl>> newHandles;
-      for (const auto &i : oldHandles) {
-         if (auto p = i.lock()) {
-            newHandles.push_back(p);
-         }
-      }
-      lastSize = newHandles.size();
-      shapeHandles() = std::move(newHandles);
-   }
+   } );
 }
 
 void PShape::close() {
@@ -1793,7 +2318,6 @@ void PShape::close() {
 }
 
 PShape::PShape(std::shared_ptr<PShapeImpl> impl_) : impl(impl_) {
-   shapeHandles().push_back(impl_);
 }
 
 const PMatrix &PShape::getShapeMatrix() {
@@ -1836,6 +2360,18 @@ void PShape::copyStyle( const PShape other ) {
    return impl->copyStyle( *other.impl );
 }
 
+void PShape::restyle( const PShape other, float weight_scale ) {
+   return impl->restyle( *other.impl, weight_scale );
+}
+
+bool PShape::sameStyle( const PShape other ) const {
+   return impl->sameStyle( *other.impl );
+}
+
+void PShape::reset() {
+   return impl->reset();
+}
+
 void PShape::clear() {
    return impl->clear();
 }
@@ -2014,6 +2550,10 @@ void PShape::bezierVertexQuadratic(PVector control, PVector anchor2){
 }
 
 
+void PShape::setCurveTolerance(float tolerance){
+   return impl->setCurveTolerance(tolerance);
+}
+
 void PShape::curveTightness(float alpha){
    return impl->curveTightness(alpha);
 }
@@ -2222,16 +2762,32 @@ void PShape::compile() {
    return impl->compile();
 }
 
+void PShape::compile(bool optimize) {
+   return impl->compile(optimize);
+}
+
+const gl::mesh_stats_t &PShape::compileStats() const {
+   return impl->compileStats();
+}
+
 bool PShape::isCompiled() const {
    return impl->isCompiled();
 }
 
+bool PShape::updateCompiled() {
+   return impl->updateCompiled();
+}
+
 gl::batch_t_ptr PShape::getBatch() {
    return impl->getBatch();
 }
 
-void PShape::flatten(gl::batch_t_ptr batch, const PMatrix& transform, bool flatten_transforms) const{
-   return impl->flatten(batch, transform, flatten_transforms);
+void PShape::flatten(gl::batch_t_ptr batch, const PMatrix& transform, bool flatten_transforms, const PMatrix *view_projection) const{
+   return impl->flatten(batch, transform, flatten_transforms, view_projection);
+}
+
+bool PShape::outsideFrustum(const PMatrix &clip) const{
+   return impl->outsideFrustum(clip);
 }
 
 void PShape::draw_normals(gl::batch_t_ptr batch, const PMatrix& transform, bool flatten_transforms) const{
@@ -2246,6 +2802,10 @@ void PShape::draw_fill(gl::batch_t_ptr batch, const PMatrix& transform, bool fla
    return impl->draw_fill(batch,transform, flatten_transforms);
 }
 
+void PShape::draw_convex(gl::batch_t_ptr batch, const PMatrix& transform, const std::vector<PVector> &points, std::optional<PVector> normal) const{
+   return impl->draw_convex(batch, transform, points, normal);
+}
+
 
 int PShape::getChildCount() const{
    return impl->getChildCount();
@@ -2293,7 +2853,10 @@ void PShape::attribPosition(std::string_view name, float x, float y, float z, fl
 }
 
 PShape PShape::copy() const {
-   return { std::make_shared<PShapeImpl>(*impl) };
+   auto copy = std::make_shared<PShapeImpl>(*impl);
+   copy->adoptChildren();
+   copy->shareLoaded(*impl);
+   return { copy };
 }
 
 PShape loadShape( std::string_view filename ) {
@@ -2304,96 +2867,49 @@ PShape loadShape( std::string_view filename ) {
    }
 }
 
-PShape loadShapeOBJ( std::string_view objPath ) {
-   struct VertRef {
-      VertRef(int v, int vt, int vn) : v(v), vt(vt), vn(vn) { }
-      int v, vt, vn;
-   };
-
-   using namespace std::literals;
-
-   std::ifstream inputFile("data/"s + std::string(objPath));
+// FNV-1a of the file, so a cache can tell if what it was built from changed.
+static uint64_t hashSource( std::string_view source ) {
+   if (source.empty()) {
+      return 0;
+   }
+   mapped_file_t file( "data/" + std::string(source) );
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   for (unsigned char c : file.view()) {
+      hash = (hash ^ c) * 0x100000001b3ULL;
+   }
+   return hash;
+}
 
-   if (!inputFile.is_open()) {
+void PShape::saveCompiled( std::string_view path, std::string_view source ) {
+   std::string filename = "data/" + std::string(path);
+   std::ofstream out( filename, std::ios::binary );
+   if (!out.is_open()) {
+      fmt::print("Failed to open {} to save compiled shape\n", filename);
       abort();
    }
+   impl->writeCompiled( out, hashSource( source ), width, height );
+}
 
-   PShape obj_shape = createShape();
-   obj_shape.beginShape( TRIANGLES );
-
-   std::vector< glm::vec4 > positions( 1, glm::vec4( 0, 0, 0, 0 ) );
-   std::vector< glm::vec3 > normals( 1, glm::vec3( 0, 0, 0 ) );
-   std::vector< glm::vec2 > coords( 1, glm::vec2( 0, 0 ) );
-
-   std::string currentMaterial;
-   std::string currentGroup;
-   std::string lineStr;
-   while( std::getline( inputFile, lineStr ) ) {
-      std::istringstream lineSS( lineStr );
-      std::string lineType;
-      lineSS >> lineType;
-
-      if( lineType == "v" ) {
-         // position
-         float x = 0, y = 0, z = 0, w = 1;
-         lineSS >> x >> y >> z >> w;
-         positions.emplace_back( x, y, z, w );
-      } else if( lineType == "vn" ) {
-         // normal
-         float i = 0, j = 0, k = 0;
-         lineSS >> i >> j >> k;
-         normals.push_back( glm::normalize( glm::vec3( i, j, k ) ) );
-      } else if( lineType == "vt" ) {
-         // texture coordinate
-         float i = 0, j = 0;
-         lineSS >> i >> j;
-         coords.emplace_back( i, j );
-      } else if( lineType == "f" ) {
-         // polygon
-         std::vector< VertRef > refs;
-         std::string refStr;
-         while( lineSS >> refStr ) {
-            int v = 0, vt = 0, vn = 0;
-            char x = 0, y = 0;
-            std::istringstream ref( refStr );
-            ref >> v >> x >> vt >> y >> vn;
-            refs.emplace_back( v, vt, vn );
-         }
-
-         // triangulate, assuming n>3-gons are convex and coplanar
-         for( size_t i = 1; i+1 < refs.size(); ++i ) {
-            const VertRef* p[3] = { &refs[0], &refs[i], &refs[i+1] };
-
-            // http://www.opengl.org/wiki/Calculating_a_Surface_Normal
-            glm::vec3 U( positions[ p[1]->v ] - positions[ p[0]->v ] );
-            glm::vec3 V( positions[ p[2]->v ] - positions[ p[0]->v ] );
-            glm::vec3 faceNormal = glm::normalize( glm::cross( U, V ) );
+PShape loadCompiled( std::string_view path, std::string_view source ) {
+   std::string filename = "data/" + std::string(path);
+   if (!std::filesystem::exists( filename )) {
+      return {};
+   }
+   mapped_file_t file( filename );
+   PShape shape = createShape();
+   if (!shape.impl->readCompiled( file.view(), hashSource( source ), shape.width, shape.height )) {
+      return {};
+   }
+   return shape;
+}
 
-            for(auto & j : p) {
-               obj_shape.normal( j->vn != 0 ? normals[ j->vn ] : faceNormal );
-               obj_shape.vertex( glm::vec3( positions[ j->v ] ), {coords[ j->vt].x,1.0F-coords[ j->vt].y}  );
-            }
-         }
-      } else if( lineType == "g" ) {
-         std::string name;
-         lineSS >> name;
-         currentGroup = name;
-      } else if( lineType == "usemtl" ) {
-         std::string name;
-         lineSS >> name;
-         currentMaterial = name;
-         obj_shape.material( materials[currentMaterial] );
-      } else if( lineType == "mtllib" ) {
-         std::string name;
-         lineSS >> name;
-         loadMaterials( name.c_str() );
-      } else if( lineType == "#" ) {
-      } else {
-         fmt::print("Unrecognized OBJ file line: {}\n", lineStr);
-      }
+PShape loadShapeCompiled( std::string_view source, std::string_view path ) {
+   PShape shape = loadCompiled( path, source );
+   if (!shape) {
+      shape = loadShape( source );
+      shape.saveCompiled( path, source );
    }
-   obj_shape.endShape();
-   return obj_shape;
+   return shape;
 }
 
 PShape::PShape() : impl( nullptr ) {}
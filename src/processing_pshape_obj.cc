@@ -0,0 +1,358 @@
+#include "processing_pshape.h"
+#include "processing_pmaterial.h"
+#include "processing_math.h"
+#include "processing_enum.h"
+#include "processing_mapped_file.h"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <charconv>
+#include <future>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+static std::string_view nextLine(std::string_view &text) {
+   auto eol = text.find('\n');
+   auto line = text.substr( 0, eol );
+   text.remove_prefix( eol == std::string_view::npos ? text.size() : eol + 1 );
+   if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+   }
+   return line;
+}
+
+static std::string_view nextToken(std::string_view &line) {
+   auto start = line.find_first_not_of(" \t");
+   if (start == std::string_view::npos) {
+      line = {};
+      return {};
+   }
+   line.remove_prefix( start );
+   auto end = std::min( line.find_first_of(" \t"), line.size() );
+   auto token = line.substr( 0, end );
+   line.remove_prefix( end );
+   return token;
+}
+
+static float parseFloat(std::string_view token, float fallback) {
+   if (!token.empty() && token.front() == '+') {
+      token.remove_prefix(1);
+   }
+   float value = fallback;
+   std::from_chars( token.data(), token.data() + token.size(), value );
+   return value;
+}
+
+static int parseInt(std::string_view token) {
+   if (!token.empty() && token.front() == '+') {
+      token.remove_prefix(1);
+   }
+   int value = 0;
+   std::from_chars( token.data(), token.data() + token.size(), value );
+   return value;
+}
+
+// Position, texture coordinate and normal, as indices into the arrays of
+// all of them in the file. Zero means not given.
+struct obj_ref_t {
+   int v, vt, vn;
+};
+
+struct obj_chunk_t {
+   std::string_view text;
+
+   // How many of each this chunk defines and how many came before it.
+   int positions = 0;
+   int coords = 0;
+   int normals = 0;
+   int positions_before = 0;
+   int coords_before = 0;
+   int normals_before = 0;
+
+   // Three refs per triangle.
+   std::vector<obj_ref_t> triangles;
+   // usemtl names along with how many refs had been emitted when they
+   // showed up.
+   std::vector<std::pair<size_t, std::string>> materials;
+   std::vector<std::string> libraries;
+};
+
+// Split text into roughly equal pieces that all end on a line boundary.
+static std::vector<obj_chunk_t> splitChunks(std::string_view text) {
+   constexpr size_t MinChunkSize = 256 * 1024;
+   size_t threads = std::max( 1U, std::thread::hardware_concurrency() );
+   size_t count = std::clamp( text.size() / MinChunkSize, (size_t)1, threads );
+   size_t target = text.size() / count + 1;
+
+   std::vector<obj_chunk_t> chunks;
+   while (!text.empty()) {
+      size_t end = text.size();
+      if (target < text.size()) {
+         end = text.find( '\n', target );
+         end = end == std::string_view::npos ? text.size() : end + 1;
+      }
+      chunks.emplace_back().text = text.substr( 0, end );
+      text.remove_prefix( end );
+   }
+   return chunks;
+}
+
+template <typename F>
+static void forEachChunk(std::vector<obj_chunk_t> &chunks, F f) {
+   std::vector<std::future<void>> work;
+   for (size_t i = 1; i < chunks.size(); ++i) {
+      work.push_back( std::async( std::launch::async, f, std::ref(chunks[i]) ) );
+   }
+   if (!chunks.empty()) {
+      f( chunks[0] );
+   }
+   for (auto &w : work) {
+      w.get();
+   }
+}
+
+static void countChunk(obj_chunk_t &chunk) {
+   std::string_view text = chunk.text;
+   while (!text.empty()) {
+      std::string_view line = nextLine( text );
+      std::string_view type = nextToken( line );
+      if (type == "v") {
+         chunk.positions++;
+      } else if (type == "vt") {
+         chunk.coords++;
+      } else if (type == "vn") {
+         chunk.normals++;
+      }
+   }
+}
+
+static void parseChunk(obj_chunk_t &chunk, std::vector<glm::vec3> &positions,
+                       std::vector<glm::vec2> &coords, std::vector<glm::vec3> &normals) {
+   int v = chunk.positions_before;
+   int vt = chunk.coords_before;
+   int vn = chunk.normals_before;
+   // Negative references count back from the most recent definition.
+   auto resolve = [](int index, int defined) {
+      return index < 0 ? defined + index + 1 : index;
+   };
+
+   std::vector<obj_ref_t> face;
+   std::string_view text = chunk.text;
+   while (!text.empty()) {
+      std::string_view whole = nextLine( text );
+      std::string_view line = whole;
+      std::string_view type = nextToken( line );
+
+      if (type == "v") {
+         float x = parseFloat( nextToken( line ), 0 );
+         float y = parseFloat( nextToken( line ), 0 );
+         float z = parseFloat( nextToken( line ), 0 );
+         positions[++v] = { x, y, z };
+      } else if (type == "vn") {
+         float i = parseFloat( nextToken( line ), 0 );
+         float j = parseFloat( nextToken( line ), 0 );
+         float k = parseFloat( nextToken( line ), 0 );
+         normals[++vn] = glm::normalize( glm::vec3( i, j, k ) );
+      } else if (type == "vt") {
+         float i = parseFloat( nextToken( line ), 0 );
+         float j = parseFloat( nextToken( line ), 0 );
+         coords[++vt] = { i, j };
+      } else if (type == "f") {
+         face.clear();
+         for (auto ref = nextToken( line ); !ref.empty(); ref = nextToken( line )) {
+            // v, v/vt, v//vn or v/vt/vn
+            auto slash1 = ref.find('/');
+            auto slash2 = slash1 == std::string_view::npos ? slash1 : ref.find( '/', slash1 + 1 );
+            int rv = parseInt( ref.substr( 0, slash1 ) );
+            int rvt = slash1 == std::string_view::npos ? 0 : parseInt( ref.substr( slash1 + 1, slash2 - slash1 - 1 ) );
+            int rvn = slash2 == std::string_view::npos ? 0 : parseInt( ref.substr( slash2 + 1 ) );
+            face.push_back( { resolve( rv, v ), resolve( rvt, vt ), resolve( rvn, vn ) } );
+         }
+         // triangulate, assuming n>3-gons are convex and coplanar
+         for (size_t i = 1; i + 1 < face.size(); ++i) {
+            chunk.triangles.push_back( face[0] );
+            chunk.triangles.push_back( face[i] );
+            chunk.triangles.push_back( face[i+1] );
+         }
+      } else if (type == "usemtl") {
+         chunk.materials.emplace_back( chunk.triangles.size(), std::string( nextToken( line ) ) );
+      } else if (type == "mtllib") {
+         chunk.libraries.emplace_back( nextToken( line ) );
+      } else if (type.empty() || type.front() == '#' || type == "g" || type == "o" || type == "s") {
+      } else {
+         fmt::print("Unrecognized OBJ file line: {}\n", whole);
+      }
+   }
+}
+
+// Builds indexed TRIANGLES shapes from the parsed refs, sharing vertices
+// that are used more than once. A shape can only index 65536 vertices so
+// big meshes are split across several.
+class obj_builder_t {
+   struct key_t {
+      int v, vt, vn, material;
+      bool operator==(const key_t &) const = default;
+   };
+
+   struct key_hash_t {
+      size_t operator()(const key_t &k) const {
+         uint64_t h = (uint64_t)(uint32_t)k.v * 0x9E3779B97F4A7C15ULL;
+         h ^= ((uint64_t)(uint32_t)k.vt << 32 | (uint32_t)k.vn) + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+         h ^= (uint64_t)(uint32_t)k.material + (h << 6) + (h >> 2);
+         return h;
+      }
+   };
+
+   static constexpr int MaxVertices = 65536;
+
+   const std::vector<glm::vec3> &positions;
+   const std::vector<glm::vec2> &coords;
+   const std::vector<glm::vec3> &normals;
+
+   std::vector<PShape> parts;
+   std::unordered_map<key_t, unsigned short, key_hash_t> seen;
+   int vertex_count = 0;
+   int material = 0;
+   std::optional<std::string> material_name;
+
+   void newPart() {
+      if (!parts.empty()) {
+         parts.back().endShape();
+      }
+      parts.push_back( createShape() );
+      parts.back().beginShape( TRIANGLES );
+      if (material_name) {
+         parts.back().material( materials[*material_name] );
+      }
+      seen.clear();
+      vertex_count = 0;
+   }
+
+   void check(const obj_ref_t &r) const {
+      if (r.v <= 0 || r.v >= (int)positions.size() ||
+          r.vt < 0 || r.vt >= (int)coords.size() ||
+          r.vn < 0 || r.vn >= (int)normals.size()) {
+         fmt::print("OBJ face refers to undefined vertex data {}/{}/{}\n", r.v, r.vt, r.vn);
+         abort();
+      }
+   }
+
+   unsigned short emit(const obj_ref_t &r, const glm::vec3 &faceNormal) {
+      PShape &shape = parts.back();
+      // Vertices without a normal of their own take their face's normal
+      // and so can't be shared.
+      if (r.vn != 0) {
+         auto [ i, inserted ] = seen.try_emplace( key_t{ r.v, r.vt, r.vn, material }, (unsigned short)vertex_count );
+         if (!inserted) {
+            return i->second;
+         }
+      }
+      shape.normal( r.vn != 0 ? normals[ r.vn ] : faceNormal );
+      shape.vertex( positions[ r.v ], { coords[ r.vt ].x, 1.0F - coords[ r.vt ].y } );
+      return vertex_count++;
+   }
+
+public:
+   obj_builder_t(const std::vector<glm::vec3> &positions, const std::vector<glm::vec2> &coords,
+                 const std::vector<glm::vec3> &normals) :
+      positions( positions ), coords( coords ), normals( normals ) {
+      newPart();
+   }
+
+   void useMaterial(const std::string &name) {
+      material++;
+      material_name = name;
+      parts.back().material( materials[name] );
+   }
+
+   void triangle(const obj_ref_t *p) {
+      for (int i = 0; i < 3; ++i) {
+         check( p[i] );
+      }
+      if (vertex_count + 3 > MaxVertices) {
+         newPart();
+      }
+      // http://www.opengl.org/wiki/Calculating_a_Surface_Normal
+      glm::vec3 faceNormal;
+      if (p[0].vn == 0 || p[1].vn == 0 || p[2].vn == 0) {
+         glm::vec3 U( positions[ p[1].v ] - positions[ p[0].v ] );
+         glm::vec3 V( positions[ p[2].v ] - positions[ p[0].v ] );
+         faceNormal = glm::normalize( glm::cross( U, V ) );
+      }
+      for (int i = 0; i < 3; ++i) {
+         parts.back().index( emit( p[i], faceNormal ) );
+      }
+   }
+
+   PShape finish() {
+      parts.back().endShape();
+      if (parts.size() == 1) {
+         return parts.back();
+      }
+      PShape group = createShape();
+      group.beginShape( GROUP );
+      for (auto &part : parts) {
+         group.addChild( part );
+      }
+      group.endShape( CLOSE );
+      return group;
+   }
+};
+
+PShape loadShapeOBJ( std::string_view objPath ) {
+   using namespace std::literals;
+
+   mapped_file_t file( "data/"s + std::string(objPath) );
+   auto chunks = splitChunks( file.view() );
+
+   // First count what each chunk defines so every chunk knows where its
+   // data goes, then parse them all straight into place.
+   forEachChunk( chunks, countChunk );
+
+   int total_positions = 0, total_coords = 0, total_normals = 0;
+   for (auto &chunk : chunks) {
+      chunk.positions_before = total_positions;
+      chunk.coords_before = total_coords;
+      chunk.normals_before = total_normals;
+      total_positions += chunk.positions;
+      total_coords += chunk.coords;
+      total_normals += chunk.normals;
+   }
+
+   // Index zero is what refs that leave out a coordinate or normal use.
+   std::vector<glm::vec3> positions( total_positions + 1, glm::vec3( 0, 0, 0 ) );
+   std::vector<glm::vec2> coords( total_coords + 1, glm::vec2( 0, 0 ) );
+   std::vector<glm::vec3> normals( total_normals + 1, glm::vec3( 0, 0, 0 ) );
+
+   forEachChunk( chunks, [&](obj_chunk_t &chunk) {
+      parseChunk( chunk, positions, coords, normals );
+   } );
+
+   for (auto &chunk : chunks) {
+      for (auto &name : chunk.libraries) {
+         loadMaterials( name.c_str() );
+      }
+   }
+
+   obj_builder_t builder( positions, coords, normals );
+   for (auto &chunk : chunks) {
+      auto material = chunk.materials.begin();
+      for (size_t i = 0; i < chunk.triangles.size(); i += 3) {
+         while (material != chunk.materials.end() && material->first <= i) {
+            builder.useMaterial( material->second );
+            ++material;
+         }
+         builder.triangle( &chunk.triangles[i] );
+      }
+      for (; material != chunk.materials.end(); ++material) {
+         builder.useMaterial( material->second );
+      }
+   }
+   return builder.finish();
+}
@@ -4,233 +4,378 @@
 #include "processing_enum.h"
 
 #include <fmt/core.h>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <future>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
+// Cursor over an attribute value. Takes every number format SVG allows,
+// including exponents and numbers run together like "1.5.5" or "1-2". On
+// bad input ok() goes false and everything after reads as zero.
+class svg_reader_t {
+   std::string_view text;
+   bool good = true;
 
-static bool isDigit(std::string::const_iterator x, std::string::const_iterator end) {
-   return (x != end) && ( (*x >= '0' && *x <='9')  || *x == '.');
-}
+   static bool isSpace(char c) {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+   }
+
+public:
+   explicit svg_reader_t(std::string_view text) : text(text) {}
 
-static void parseWhiteSpace(std::string::const_iterator &x, std::string::const_iterator end) {
-   while( (x != end) && ( *x == ' ' || *x == '\n' || *x == '\t') ) {
-      x++;
+   bool ok() const {
+      return good;
    }
-}
 
-static void parseSign(std::string::const_iterator &x,  std::string::const_iterator end, float &value) {
-   if (x == end) {
-      abort();
+   void skipSpace() {
+      while (!text.empty() && isSpace(text.front())) {
+         text.remove_prefix(1);
+      }
    }
-   if (*x == '-') {
-      x++;
-      value = -1.0;
-   } else {
-      value = 1.0;
+
+   // Whitespace with at most one comma somewhere in it.
+   void skipSeparator() {
+      skipSpace();
+      if (!text.empty() && text.front() == ',') {
+         text.remove_prefix(1);
+         skipSpace();
+      }
    }
-}
 
-static void parseFloat(std::string::const_iterator &x, std::string::const_iterator end, float &value) {
-   if (x == end)
-      abort();
-   parseWhiteSpace( x, end );
-   auto begin = x;
-   parseSign( x, end, value );
-   while( isDigit( x, end ) ) { x++; }
-   std::string z(begin,x);
-   if (z.length() == 0)
-      abort();
-   value = std::stof(z);
-}
+   bool done() {
+      skipSpace();
+      return !good || text.empty();
+   }
 
-static float cx, cy, lx, ly;
-
-static void parseMove(std::string::const_iterator &i, std::string::const_iterator end, PShape& pshape) {
-   parseWhiteSpace( i, end );
-   if (*i == 'M') {
-      i++;
-      float x;
-      parseFloat( i, end, x );
-      if ( *i == ',') i++;
-      float y;
-      parseFloat( i, end, y );
-      pshape.beginShape();
-      pshape.vertex(x,y);
-      lx = x;
-      ly = y;
+   char peek() {
+      skipSpace();
+      return text.empty() ? 0 : text.front();
    }
-}
 
-static void parseLine( std::string::const_iterator &i,  std::string::const_iterator end, PShape &pshape) {
-   parseWhiteSpace( i, end );
-   if (i == end)
-       return;
-   if (*i == 'l') {
-      i++;
-      float x2,y2;
-      parseFloat( i, end, x2);
-      if ( *i == ',') i++;
-      parseFloat( i, end, y2);
-      pshape.vertex(lx+x2,ly+y2);
-      lx = lx+x2;
-      ly = ly+y2;
-   }
-   else if (*i == 'L') {
-      i++;
-      float x2,y2;
-      parseFloat( i, end, x2);
-      if ( *i == ',') i++;
-      parseFloat( i, end, y2);
-      pshape.vertex(x2,y2);
-      lx = x2;
-      ly = y2;
-   }
-   else if (*i == 'h') {
-      i++;
-      float x2;
-      parseFloat( i, end, x2);
-      pshape.vertex(lx+x2, ly);
-      lx = lx + x2;
-      ly = ly;
-   }
-   else if (*i == 'H') {
-      i++;
-      float x2;
-      parseFloat( i,end,x2);
-      pshape.vertex(x2,ly);
-      lx = x2;
-      ly = ly;
-   }
-   else if (*i == 'v') {
-      i++;
-      float y2;
-      parseFloat( i,end,y2);
-      pshape.vertex(lx,ly+y2);
-      lx = lx;
-      ly = ly +y2;
-   }
-   else if (*i == 'V') {
-      i++;
-      float y2;
-      parseFloat( i,end,y2);
-      pshape.vertex(lx,y2);
-      lx = lx;
-      ly = y2;
+   bool peekNumber() {
+      skipSeparator();
+      if (text.empty()) {
+         return false;
+      }
+      char c = text.front();
+      return (c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+';
    }
-}
 
-static void parseCurve(std::string::const_iterator &i, std::string::const_iterator end, PShape& pshape) {
-   parseWhiteSpace( i, end );
-   if (*i == 'c') {
-      i++;
-      float x2,y2,x3,y3,x4,y4;
-      parseFloat( i, end,x2);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y2);
-      if ( *i == ',') i++;
-      parseFloat( i, end,x3);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y3);
-      if ( *i == ',') i++;
-      parseFloat( i, end,x4);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y4);
-
-      pshape.bezierVertex(lx+x2,ly+y2,lx+x3,ly+y3,lx+x4,ly+y4);
-      cx = lx+x3;
-      cy = ly+y3;
-      lx = lx+x4;
-      ly = ly+y4;
-   }
-   else if (*i == 'C') {
-      i++;
-      float x2,y2,x3,y3,x4,y4;
-      parseFloat( i, end,x2);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y2);
-      if ( *i == ',') i++;
-      parseFloat( i, end,x3);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y3);
-      if ( *i == ',') i++;
-      parseFloat( i, end,x4);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y4);
-
-      pshape.bezierVertex(x2,y2,x3,y3,x4,y4);
-      cx = x3;
-      cy = y3;
-      lx = x4;
-      ly = y4;
-   }
-   else if (*i == 's') {
-      i++;
-      float x2,y2,x3,y3,x4,y4;
-      x2 = (lx - cx);
-      y2 = (ly - cy);
-      parseFloat( i,end,x3);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y3);
-      if ( *i == ',') i++;
-      parseFloat( i, end,x4);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y4);
-
-      pshape.bezierVertex(lx+x2,ly+y2,lx+x3,ly+y3,lx+x4,ly+y4);
-      cx = lx+x3;
-      cy = ly+y3;
-      lx = lx+x4;
-      ly = ly+y4;
-   }
-   else if (*i == 'S') {
-      i++;
-      float x2,y2,x3,y3,x4,y4;
-      x2 = lx - (cx - lx);
-      y2 = ly - (cy - ly);
-      parseFloat( i, end,x3);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y3);
-      if ( *i == ',') i++;
-      parseFloat( i, end,x4);
-      if ( *i == ',') i++;
-      parseFloat( i, end,y4);
-
-      pshape.bezierVertex(x2,y2,x3,y3,x4,y4);
-      cx = x3;
-      cy = y3;
-      lx = x4;
-      ly = y4;
+   char next() {
+      skipSpace();
+      if (text.empty()) {
+         return 0;
+      }
+      char c = text.front();
+      text.remove_prefix(1);
+      return c;
+   }
+
+   float number() {
+      skipSeparator();
+      if (!text.empty() && text.front() == '+') {
+         text.remove_prefix(1);
+      }
+      float value = 0.0F;
+      auto [ end, error ] = std::from_chars( text.data(), text.data() + text.size(), value );
+      if (!good || error != std::errc()) {
+         good = false;
+         return 0.0F;
+      }
+      text.remove_prefix( end - text.data() );
+      return value;
+   }
+
+   PVector point() {
+      float x = number();
+      float y = number();
+      return { x, y };
+   }
+
+   // Arc flags are a single 0 or 1 and don't need separating from what
+   // follows them.
+   bool flag() {
+      skipSeparator();
+      if (text.empty() || (text.front() != '0' && text.front() != '1')) {
+         good = false;
+         return false;
+      }
+      bool value = text.front() == '1';
+      text.remove_prefix(1);
+      return value;
+   }
+
+   bool literal(std::string_view s) {
+      skipSpace();
+      if (text.substr(0, s.size()) != s) {
+         good = false;
+         return false;
+      }
+      text.remove_prefix( s.size() );
+      return true;
+   }
+
+   std::string_view rest() const {
+      return text;
+   }
+};
+
+// Turns path data into contours on a shape. Keeps the pen position and
+// previous control point for the relative and smooth commands.
+class svg_path_t {
+   PShape &shape;
+   PVector current{ 0, 0 };
+   PVector start{ 0, 0 };
+   PVector control{ 0, 0 };
+   char previous = 0;
+   bool in_contour = false;
+   bool closed = false;
+
+   void ensureContour() {
+      if (!in_contour) {
+         shape.beginContour();
+         shape.vertex( current.x, current.y );
+         in_contour = true;
+         closed = false;
+      }
    }
-}
 
-static void parseText(std::string::const_iterator &i, std::string::const_iterator end, std::string_view text) {
-   parseWhiteSpace( i, end );
-   for( char x : text ) {
-      if ( i == end )
-         abort();
-      if (x != *i++) abort();
+   void endContour() {
+      if (in_contour) {
+         shape.endContour();
+         in_contour = false;
+      }
    }
+
+public:
+   explicit svg_path_t(PShape &shape) : shape(shape) {}
+
+   void moveTo(PVector p) {
+      endContour();
+      current = start = p;
+      ensureContour();
+   }
+
+   void lineTo(PVector p) {
+      ensureContour();
+      shape.vertex( p.x, p.y );
+      current = p;
+   }
+
+   void cubicTo(PVector c1, PVector c2, PVector p) {
+      ensureContour();
+      shape.bezierVertex( c1.x, c1.y, c2.x, c2.y, p.x, p.y );
+      control = c2;
+      current = p;
+   }
+
+   void quadraticTo(PVector c, PVector p) {
+      ensureContour();
+      shape.bezierVertexQuadratic( c, p );
+      control = c;
+      current = p;
+   }
+
+   // Endpoint arc, converted to a centre parameterisation and then drawn
+   // as one cubic per quarter turn or less. See the SVG implementation
+   // notes, appendix F.6.
+   void arcTo(float rx, float ry, float angle, bool large, bool sweep, PVector p) {
+      if (p.x == current.x && p.y == current.y) {
+         return;
+      }
+      rx = std::abs(rx);
+      ry = std::abs(ry);
+      if (rx == 0.0F || ry == 0.0F) {
+         lineTo( p );
+         return;
+      }
+      float phi = radians( angle );
+      float c = std::cos( phi );
+      float s = std::sin( phi );
+      float dx = (current.x - p.x) / 2.0F;
+      float dy = (current.y - p.y) / 2.0F;
+      float x1 = c * dx + s * dy;
+      float y1 = -s * dx + c * dy;
+
+      float lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+      if (lambda > 1.0F) {
+         rx *= std::sqrt( lambda );
+         ry *= std::sqrt( lambda );
+      }
+      float num = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+      float den = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+      float coef = (large != sweep ? 1.0F : -1.0F) * std::sqrt( std::max( 0.0F, num / den ) );
+      float cx1 = coef * rx * y1 / ry;
+      float cy1 = -coef * ry * x1 / rx;
+      PVector centre = { c * cx1 - s * cy1 + (current.x + p.x) / 2.0F,
+                         s * cx1 + c * cy1 + (current.y + p.y) / 2.0F };
+
+      auto angleBetween = [](float ux, float uy, float vx, float vy) {
+         return std::atan2( ux * vy - uy * vx, ux * vx + uy * vy );
+      };
+      float theta = angleBetween( 1.0F, 0.0F, (x1 - cx1) / rx, (y1 - cy1) / ry );
+      float delta = angleBetween( (x1 - cx1) / rx, (y1 - cy1) / ry, (-x1 - cx1) / rx, (-y1 - cy1) / ry );
+      if (!sweep && delta > 0.0F) {
+         delta -= TWO_PI;
+      } else if (sweep && delta < 0.0F) {
+         delta += TWO_PI;
+      }
+
+      auto pointAt = [&](float a) {
+         float x = rx * std::cos( a );
+         float y = ry * std::sin( a );
+         return PVector{ centre.x + c * x - s * y, centre.y + s * x + c * y };
+      };
+      auto tangentAt = [&](float a) {
+         float x = -rx * std::sin( a );
+         float y = ry * std::cos( a );
+         return PVector{ c * x - s * y, s * x + c * y };
+      };
+
+      int segments = std::max( 1, (int)std::ceil( std::abs( delta ) / HALF_PI - 0.001F ) );
+      float step = delta / segments;
+      float k = 4.0F / 3.0F * std::tan( step / 4.0F );
+      for (int i = 0; i < segments; ++i) {
+         float a1 = theta + i * step;
+         float a2 = a1 + step;
+         PVector e1 = pointAt( a1 );
+         PVector e2 = i == segments - 1 ? p : pointAt( a2 );
+         cubicTo( e1 + k * tangentAt( a1 ), e2 - k * tangentAt( a2 ), e2 );
+      }
+   }
+
+   void close() {
+      if (in_contour) {
+         shape.endContour();
+         in_contour = false;
+         closed = true;
+      }
+      current = start;
+   }
+
+   // Run the whole of the path data, stopping at the first error as the
+   // SVG spec asks.
+   void parse(std::string_view data) {
+      svg_reader_t r( data );
+      char command = 0;
+      while (!r.done()) {
+         char c = r.peek();
+         if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) {
+            command = r.next();
+         } else if (command == 'M') {
+            // Extra coordinate pairs after a move are lines.
+            command = 'L';
+         } else if (command == 'm') {
+            command = 'l';
+         } else if (command == 0 || command == 'z' || command == 'Z') {
+            break;
+         }
+         bool relative = command >= 'a';
+         PVector base = relative ? current : PVector{ 0, 0 };
+         auto at = [&](PVector p) { return PVector{ base.x + p.x, base.y + p.y }; };
+
+         switch (command) {
+         case 'M': case 'm':
+            moveTo( at( r.point() ) );
+            break;
+         case 'L': case 'l':
+            lineTo( at( r.point() ) );
+            break;
+         case 'H': case 'h':
+            lineTo( { r.number() + (relative ? current.x : 0.0F), current.y } );
+            break;
+         case 'V': case 'v':
+            lineTo( { current.x, r.number() + (relative ? current.y : 0.0F) } );
+            break;
+         case 'C': case 'c': {
+            PVector c1 = at( r.point() );
+            PVector c2 = at( r.point() );
+            cubicTo( c1, c2, at( r.point() ) );
+            break;
+         }
+         case 'S': case 's': {
+            PVector c1 = current;
+            if (previous == 'C' || previous == 'S') {
+               c1 = { 2 * current.x - control.x, 2 * current.y - control.y };
+            }
+            PVector c2 = at( r.point() );
+            cubicTo( c1, c2, at( r.point() ) );
+            break;
+         }
+         case 'Q': case 'q': {
+            PVector c1 = at( r.point() );
+            quadraticTo( c1, at( r.point() ) );
+            break;
+         }
+         case 'T': case 't': {
+            PVector c1 = current;
+            if (previous == 'Q' || previous == 'T') {
+               c1 = { 2 * current.x - control.x, 2 * current.y - control.y };
+            }
+            quadraticTo( c1, at( r.point() ) );
+            break;
+         }
+         case 'A': case 'a': {
+            float rx = r.number();
+            float ry = r.number();
+            float angle = r.number();
+            bool large = r.flag();
+            bool sweep = r.flag();
+            PVector p = at( r.point() );
+            if (r.ok()) {
+               arcTo( rx, ry, angle, large, sweep, p );
+            }
+            break;
+         }
+         case 'Z': case 'z':
+            close();
+            break;
+         default:
+            fmt::print("Unsupported SVG path command '{}'\n", command);
+            return;
+         }
+         if (!r.ok()) {
+            fmt::print("Error in SVG path data near '{}'\n", r.rest().substr(0, 16));
+            break;
+         }
+         previous = command & ~0x20;
+      }
+      endContour();
+   }
+
+   bool isClosed() const {
+      return closed;
+   }
+};
+
+static float parseSVGNumber(std::string_view data) {
+   svg_reader_t r( data );
+   return r.number();
 }
 
-static void parseSVGTransform(const std::string &data, PShape &pshape,
-                              PMatrix &transform) {
-   auto i = data.begin();
-   auto end = data.end();
-   parseText(i ,end, "matrix(");
-   float x1,x2,x3,x4,x5,x6;
-   parseFloat( i,end,x1);
-   if ( *i == ',') i++;
-   parseFloat( i,end,x2);
-   if ( *i == ',') i++;
-   parseFloat( i,end,x3);
-   if ( *i == ',') i++;
-   parseFloat( i,end,x4);
-   if ( *i == ',') i++;
-   parseFloat( i,end,x5);
-   if ( *i == ',') i++;
-   parseFloat( i,end,x6);
-   parseText(i ,end, ")");
+static void parseSVGTransform(std::string_view data, PMatrix &transform) {
+   svg_reader_t r( data );
+   r.literal("matrix(");
+   float x1 = r.number();
+   float x2 = r.number();
+   float x3 = r.number();
+   float x4 = r.number();
+   float x5 = r.number();
+   float x6 = r.number();
+   r.literal(")");
+   if (!r.ok()) {
+      fmt::print("Unsupported SVG transform '{}'\n", data);
+      abort();
+   }
 
    transform = PMatrix{ glm::mat4( x1, x2, 0, 0,
                                    x3, x4, 0, 0,
@@ -238,297 +383,174 @@ static void parseSVGTransform(const std::string &data, PShape &pshape,
                                    x5, x6, 0, 1 ) };
 }
 
-static void parseSVGFillColor(const std::string &data, PShape &pshape, int alpha) {
-   if (data != "none") {
-      std::string R( data.begin()+1, data.begin()+3 );
-      std::string G( data.begin()+3, data.begin()+5 );
-      std::string B( data.begin()+5, data.begin()+7 );
-      int iR = std::stoi(R,nullptr,16);
-      int iG = std::stoi(G,nullptr,16);
-      int iB = std::stoi(B,nullptr,16);
-      pshape.fill(iR,iG,iB, alpha );
+// #rgb or #rrggbb, anything else is treated as none.
+static std::optional<std::array<int,3>> parseSVGColor(std::string_view data) {
+   if (data.empty() || data.front() != '#') {
+      return {};
+   }
+   data.remove_prefix(1);
+   unsigned int rgb = 0;
+   auto [ end, error ] = std::from_chars( data.data(), data.data() + data.size(), rgb, 16 );
+   if (error != std::errc()) {
+      return {};
+   }
+   if (end - data.data() == 3) {
+      int r = (rgb >> 8) & 0xF, g = (rgb >> 4) & 0xF, b = rgb & 0xF;
+      return std::array<int,3>{ r * 17, g * 17, b * 17 };
+   }
+   return std::array<int,3>{ (int)(rgb >> 16) & 0xFF, (int)(rgb >> 8) & 0xFF, (int)rgb & 0xFF };
+}
+
+static void parseSVGFillColor(std::string_view data, PShape &pshape, int alpha) {
+   if (auto rgb = parseSVGColor( data )) {
+      pshape.fill( (*rgb)[0], (*rgb)[1], (*rgb)[2], alpha );
    } else {
       pshape.noFill();
    }
 }
 
-static void parseSVGStrokeColor(const std::string &data, PShape &pshape, int alpha) {
-   if (data != "none") {
-      std::string R( data.begin()+1, data.begin()+3 );
-      std::string G( data.begin()+3, data.begin()+5 );
-      std::string B( data.begin()+5, data.begin()+7 );
-      pshape.stroke( std::stoi(R,nullptr,16), std::stoi(G,nullptr,16), std::stoi(B,nullptr,16), alpha );
+static void parseSVGStrokeColor(std::string_view data, PShape &pshape, int alpha) {
+   if (auto rgb = parseSVGColor( data )) {
+      pshape.stroke( (*rgb)[0], (*rgb)[1], (*rgb)[2], alpha );
    } else {
       pshape.noStroke();
    }
 }
 
-static void parseSVGStrokeWeight(const std::string &data, PShape &pshape) {
-   pshape.strokeWeight( std::stof( data ) );
-}
-
-static void parseSVGOpacity(const std::string &data, int &alpha) {
-   alpha = std::stof( data ) * 255;
+static void parseSVGPath(std::string_view data, PShape& pshape) {
+   pshape.beginShape();
+   svg_path_t path( pshape );
+   path.parse( data );
+   pshape.endShape( path.isClosed() ? CLOSE : OPEN );
 }
 
-static void parseSVGID(const std::string &data, PShape& pshape) {
-   pshape.setID( data );
+static void parseSVGPolygon(std::string_view data, PShape& pshape) {
+   svg_reader_t r( data );
+   pshape.beginShape();
+   while (r.peekNumber()) {
+      PVector p = r.point();
+      if (!r.ok()) {
+         break;
+      }
+      pshape.vertex( p.x, p.y );
+   }
+   pshape.endShape(CLOSE);
 }
 
-static void parseSVGPath(const std::string &data, PShape& pshape) {
-   std::string::const_iterator i = data.begin();
-   std::string::const_iterator end = data.end();
-   pshape.beginShape();
+// An attribute of an XML node, freed when it goes out of scope.
+class svg_attribute_t {
+   xmlChar *data;
 
-   parseWhiteSpace(i, end) ;
-   bool open = true;
-   while ( i != end && *i == 'M') {
-      pshape.beginContour();
-      i++;
-      float x;
-      parseFloat( i, end, x );
-      if ( *i == ',') i++;
-      float y;
-      parseFloat( i, end, y );
-      pshape.vertex(x,y);
-      lx = x;
-      ly = y;
-      parseWhiteSpace(i, end);
-      while ( i != end && (*i == 'c' || *i == 'C' || *i == 's' || *i == 'S'|| *i == 'l' || *i == 'L'
-             || *i == 'h' || *i == 'H'|| *i == 'v' || *i == 'V') ) {
-         parseCurve(i, end,pshape );
-         parseLine( i, end, pshape );
-         parseWhiteSpace(i, end);
-      }
-      if (i != end && ( *i == 'z' || *i == 'Z') )
-      {
-         open = false;
-         pshape.endContour( );
-	 i++;
-      }
-      else
-      {
-         open = true;
-         pshape.endContour();
-      }
-      parseWhiteSpace(i, end);
+public:
+   svg_attribute_t(xmlNode *node, const char *name) : data( xmlGetProp(node, (const xmlChar *)name) ) {}
+   ~svg_attribute_t() {
+      xmlFree(data);
    }
-   if (open) {
-      pshape.endShape( OPEN );
-   } else {
-      pshape.endShape( CLOSE );
+   svg_attribute_t(const svg_attribute_t &) = delete;
+   svg_attribute_t &operator=(const svg_attribute_t &) = delete;
+
+   explicit operator bool() const {
+      return data != nullptr;
    }
-}
 
-static void parseSVGPolygon(const std::string &data, PShape& pshape) {
-   std::string::const_iterator i = data.begin();
-   std::string::const_iterator end = data.end();
-   pshape.beginShape();
-   parseWhiteSpace(i, end);
-   while ( i != data.end() ) {
-      float x;
-      parseFloat( i, end, x );
-      if ( *i == ',') i++;
-      float y;
-      parseFloat( i, end, y );
-      pshape.vertex(x,y);
-      parseWhiteSpace(i, end);
+   std::string_view view() const {
+      return (const char *)data;
+   }
+};
+
+// Everything for one loadShapeSVG() call. Walking the DOM only creates
+// shapes and styles them, the path and polygon geometry is queued up to be
+// built and tessellated in parallel once the walk is done. Children are
+// attached last so that building doesn't touch any shared parents.
+class svg_loader_t {
+   struct job_t {
+      PShape shape;
+      std::string data;
+      bool polygon;
+   };
+   std::vector<job_t> jobs;
+   std::vector<std::pair<PShape, PShape>> links;
+
+   static int opacity(xmlNode *node) {
+      svg_attribute_t a( node, "opacity" );
+      return a ? parseSVGNumber( a.view() ) * 255 : 255;
    }
-   pshape.endShape(CLOSE);
-}
 
-static void parseNode(xmlNode* node, PShape& pshape) {
+   static float number(xmlNode *node, const char *name) {
+      svg_attribute_t a( node, name );
+      return a ? parseSVGNumber( a.view() ) : 0.0F;
+   }
 
-   std::string type;
-   std::string data;
+   static void style(xmlNode *node, PShape &shape, int alpha) {
+      if (svg_attribute_t a( node, "id" ); a) {
+         shape.setID( a.view() );
+      }
+      if (svg_attribute_t a( node, "fill" ); a) {
+         parseSVGFillColor( a.view(), shape, alpha );
+      }
+      if (svg_attribute_t a( node, "stroke" ); a) {
+         parseSVGStrokeColor( a.view(), shape, alpha );
+      }
+      if (svg_attribute_t a( node, "stroke-width" ); a) {
+         shape.strokeWeight( parseSVGNumber( a.view() ) );
+      }
+   }
 
-   if (node == nullptr)
-      return;
+public:
+   void parseNode(xmlNode* node, PShape& pshape) {
+      if (node == nullptr || node->type != XML_ELEMENT_NODE) {
+         return;
+      }
 
-   if (node->type == XML_ELEMENT_NODE) {
-      type = (char*)node->name;
+      std::string_view type = (const char*)node->name;
 
       if (type == "svg") {
-         xmlChar* xdata = xmlGetProp(node, (xmlChar*)"width");
-         float width, height;
-         if (xdata) {
-            auto x = std::string((char*)xdata);
-            auto y = x.cbegin();
-            auto end = x.cend();
-            parseFloat(y, end, width);
-            pshape.width = width;
+         if (svg_attribute_t a( node, "width" ); a) {
+            pshape.width = parseSVGNumber( a.view() );
          }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"height");
-         if (xdata) {
-            auto x = std::string((char*)xdata);
-            auto y = x.cbegin();
-            auto end = x.cend();
-            parseFloat(y, end,height);
-            pshape.height = height;
+         if (svg_attribute_t a( node, "height" ); a) {
+            pshape.height = parseSVGNumber( a.view() );
          }
-         xmlFree(xdata);
-
          for (xmlNode* child = node->children; child; child = child->next) {
             parseNode(child, pshape);
          }
          return;
       }
 
-      PShape shape = createShape();;
+      PShape shape = createShape();
       shape.beginShape();
       shape.fill(BLACK);
       shape.noStroke();
 
       if (type == "circle") {
-         int alpha = 255;
-         xmlChar* xdata = xmlGetProp(node, (xmlChar*)"opacity");
-         if (xdata) {
-            parseSVGOpacity((char*)xdata, alpha);
-         }
-         xmlFree(xdata);
-         float cx, cy, r;
-         xdata = xmlGetProp(node, (xmlChar*)"cx");
-         if (xdata) {
-            auto x = std::string((char*)xdata);
-            auto y = x.cbegin();
-            auto end = x.cend();
-            parseFloat(y, end, cx);
+         int alpha = opacity( node );
+         float cx = number( node, "cx" );
+         float cy = number( node, "cy" );
+         float r = number( node, "r" );
+         if (svg_attribute_t a( node, "fill" ); a) {
+            parseSVGFillColor( a.view(), shape, alpha );
          }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"cy");
-         if (xdata) {
-            auto x = std::string((char*)xdata);
-            auto y = x.cbegin();
-            auto end = x.cend();
-            parseFloat(y, end, cy);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"r");
-         if (xdata) {
-            auto x = std::string((char*)xdata);
-            auto y = x.cbegin();
-            auto end = x.cend();
-            parseFloat(y,end, r);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"fill");
-         if (xdata) {
-            parseSVGFillColor((char*)xdata, shape, alpha);
-         }
-         xmlFree(xdata);
          shape = drawUntexturedFilledEllipse( cx,cy,2*r,2*r, shape.getFillColor(), PMatrix::Identity() );
       } else if (type == "ellipse") {
-         int alpha = 255;
-         xmlChar* xdata = xmlGetProp(node, (xmlChar*)"opacity");
-         if (xdata) {
-            parseSVGOpacity((char*)xdata, alpha);
-         }
-         xmlFree(xdata);
-         float cx, cy, rx,ry;
-         xdata = xmlGetProp(node, (xmlChar*)"cx");
-         if (xdata) {
-            auto x = std::string((char*)xdata);
-            auto y = x.cbegin();
-            auto end = x.cend();
-            parseFloat(y, end,cx);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"cy");
-         if (xdata) {
-            auto x = std::string((char*)xdata);
-            auto y = x.cbegin();
-            auto end = x.cend();
-            parseFloat(y,end,  cy);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"rx");
-         if (xdata) {
-            auto x = std::string((char*)xdata);
-            auto y = x.cbegin();
-            auto end = x.cend();
-            parseFloat(y,end, rx);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"ry");
-         if (xdata) {
-            auto x = std::string((char*)xdata);
-            auto y = x.cbegin();
-            auto end = x.cend();
-            parseFloat(y, end, ry);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"fill");
-         if (xdata) {
-            parseSVGFillColor((char*)xdata, shape, alpha);
+         int alpha = opacity( node );
+         float cx = number( node, "cx" );
+         float cy = number( node, "cy" );
+         float rx = number( node, "rx" );
+         float ry = number( node, "ry" );
+         if (svg_attribute_t a( node, "fill" ); a) {
+            parseSVGFillColor( a.view(), shape, alpha );
          }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"transform");
          PMatrix transform;
-         if (xdata) {
-            parseSVGTransform((char*)xdata, shape, transform);
+         if (svg_attribute_t a( node, "transform" ); a) {
+            parseSVGTransform( a.view(), transform );
          }
-         xmlFree(xdata);
          shape = drawUntexturedFilledEllipse( cx,cy,2*rx,2*ry, shape.getFillColor(), transform );
-      } else if (type == "polygon") {
-         int alpha = 255;
-         xmlChar* xdata = xmlGetProp(node, (xmlChar*)"opacity");
-         if (xdata) {
-            parseSVGOpacity((char*)xdata, alpha);
+      } else if (type == "polygon" || type == "path") {
+         bool polygon = type == "polygon";
+         style( node, shape, opacity( node ) );
+         if (svg_attribute_t a( node, polygon ? "points" : "d" ); a) {
+            jobs.push_back( { shape, std::string( a.view() ), polygon } );
          }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"fill");
-         if (xdata) {
-            parseSVGFillColor((char*)xdata, shape,alpha);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"stroke");
-         if (xdata) {
-            parseSVGStrokeColor((char*)xdata, shape,alpha);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"stroke-width");
-         if (xdata) {
-            parseSVGStrokeWeight((char*)xdata, shape);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"points");
-         if (xdata) {
-            parseSVGPolygon((char*)xdata, shape);
-         }
-         xmlFree(xdata);
-      } else if (type == "path") {
-         int alpha = 255;
-         xmlChar* xdata = xmlGetProp(node, (xmlChar*)"opacity");
-         if (xdata) {
-            parseSVGOpacity((char*)xdata, alpha);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"id");
-         if (xdata) {
-            parseSVGID((char*)xdata, shape);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"fill");
-         if (xdata) {
-            parseSVGFillColor((char*)xdata, shape,alpha);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"stroke");
-         if (xdata) {
-            parseSVGStrokeColor((char*)xdata, shape,alpha);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"stroke-width");
-         if (xdata) {
-            parseSVGStrokeWeight((char*)xdata, shape);
-         }
-         xmlFree(xdata);
-         xdata = xmlGetProp(node, (xmlChar*)"d");
-         if (xdata) {
-            parseSVGPath((char*)xdata, shape);
-         }
-         xmlFree(xdata);
       } else {
          shape.beginShape( GROUP );
          for (xmlNode* child = node->children; child; child = child->next) {
@@ -536,9 +558,33 @@ static void parseNode(xmlNode* node, PShape& pshape) {
          }
          shape.endShape();
       }
-      pshape.addChild( shape );
+      links.emplace_back( pshape, shape );
    }
-}
+
+   void finish() {
+      size_t threads = std::max( 1U, std::thread::hardware_concurrency() );
+      size_t count = std::min( threads, jobs.size() );
+      std::vector<std::future<void>> work;
+      for (size_t t = 0; t < count; ++t) {
+         work.push_back( std::async( std::launch::async, [this, t, count] {
+            for (size_t i = t; i < jobs.size(); i += count) {
+               auto &job = jobs[i];
+               if (job.polygon) {
+                  parseSVGPolygon( job.data, job.shape );
+               } else {
+                  parseSVGPath( job.data, job.shape );
+               }
+            }
+         } ) );
+      }
+      for (auto &w : work) {
+         w.get();
+      }
+      for (auto &[ parent, child ] : links) {
+         parent.addChild( child );
+      }
+   }
+};
 
 PShape loadShapeSVG(std::string_view filename) {
    LIBXML_TEST_VERSION;
@@ -552,7 +598,9 @@ PShape loadShapeSVG(std::string_view filename) {
 
    PShape svgShape = createShape();
    svgShape.beginShape(GROUP);
-   parseNode(xmlDocGetRootElement(doc), svgShape);
+   svg_loader_t loader;
+   loader.parseNode(xmlDocGetRootElement(doc), svgShape);
+   loader.finish();
    svgShape.endShape();
 
    xmlFreeDoc(doc);